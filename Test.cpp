@@ -6,9 +6,12 @@
 #include <stdexcept>
 #include <cassert>
 #include <vector>
+#include <numeric>
 using namespace std;
 
 #include "sources/MagicalContainer.hpp"
+#include "sources/SmallMagicalContainer.hpp"
+#include "sources/FixedMagicalContainer.hpp"
 
 using namespace ariel;
 
@@ -388,11 +391,10 @@ TEST_CASE("PrimeIterator")
         CHECK((it1 == it2));
         CHECK_FALSE((it1 != it2));
 
-        ++it2;
-        ++it2;
-        ++it2;
-        CHECK((it2 > it1));
-        CHECK((it1 != it2));
+        // Both are at the end now, and a checked iterator refuses to move past it
+        CHECK_THROWS_AS(++it2, std::runtime_error);
+        CHECK_FALSE((it2 > it1));
+        CHECK((it1 == it2));
 
         CHECK(it1 == it1.end());
         CHECK(it2 == it2.end());
@@ -427,3 +429,1820 @@ TEST_CASE("PrimeIterator")
         CHECK_THROWS_AS(it7 = it8, std::runtime_error);
     }
 }
+
+TEST_CASE("MagicalContainer: removal modes and scopes")
+{
+    MagicalContainer container;
+    container.addElement(5);
+    container.addElement(8);
+    container.addElement(5);
+    container.addElement(3);
+    container.addElement(5);
+
+    SUBCASE("Ordered removal of one occurrence keeps insertion order")
+    {
+        container.removeElement(5, MagicalContainer::RemovalScope::One);
+        CHECK(container.getElemnets() == std::vector<int>{8, 5, 3, 5});
+    }
+
+    SUBCASE("Swap-and-pop removal of one occurrence")
+    {
+        container.setRemovalMode(MagicalContainer::RemovalMode::SwapAndPop);
+        container.removeElement(8, MagicalContainer::RemovalScope::One);
+        CHECK(container.getElemnets() == std::vector<int>{5, 5, 5, 3});
+    }
+
+    SUBCASE("Swap-and-pop removal of all occurrences")
+    {
+        container.setRemovalMode(MagicalContainer::RemovalMode::SwapAndPop);
+        container.removeElement(5);
+        CHECK_EQ(container.size(), 2);
+
+        std::vector<int> actual;
+        MagicalContainer::AscendingIterator ascIter(container);
+        for (auto it = ascIter.begin(); it != ascIter.end(); ++it)
+        {
+            actual.push_back(*it);
+        }
+        CHECK(actual == std::vector<int>{3, 8});
+        CHECK_THROWS_AS(container.removeElement(5), std::runtime_error);
+    }
+}
+
+TEST_CASE("MagicalContainer: tombstone removal and compaction")
+{
+    MagicalContainer container;
+    container.setRemovalMode(MagicalContainer::RemovalMode::Tombstone);
+    container.setCompactionThreshold(0.5);
+    for (int i = 1; i <= 100; ++i)
+    {
+        container.addElement(i);
+    }
+
+    container.removeElement(2);
+    container.removeElement(70);
+    container.removeElement(99);
+    CHECK_EQ(container.size(), 97);
+    CHECK_THROWS_AS(container.removeElement(70), std::runtime_error);
+
+    std::vector<int> primes;
+    MagicalContainer::PrimeIterator primeIter(container);
+    for (auto it = primeIter.begin(); it != primeIter.end(); ++it)
+    {
+        primes.push_back(*it);
+    }
+    CHECK_EQ(primes.size(), 24); // 25 primes up to 100, without 2
+    CHECK_EQ(primes.front(), 3);
+
+    // Removing more than half of the slots triggers compaction
+    for (int i = 3; i <= 60; ++i)
+    {
+        container.removeElement(i);
+    }
+    CHECK_EQ(container.size(), 39);
+    CHECK_EQ(container.getElemnets().size(), 39);
+    CHECK_EQ(container.getElemnets().front(), 1);
+
+    CHECK_THROWS_AS(container.setCompactionThreshold(1.5), std::invalid_argument);
+}
+
+TEST_CASE("MagicalContainer: run-length representation")
+{
+    MagicalContainer container;
+    container.setRepresentation(MagicalContainer::Representation::RunLength);
+    for (int i = 0; i < 50; ++i)
+    {
+        container.addElement(7);
+        container.addElement(4);
+    }
+    container.addElement(13);
+    CHECK_EQ(container.size(), 101);
+
+    container.removeElement(4, MagicalContainer::RemovalScope::One);
+    CHECK_EQ(container.size(), 100);
+    container.removeElement(7);
+    CHECK_EQ(container.size(), 50);
+    CHECK_THROWS_AS(container.removeElement(7), std::runtime_error);
+
+    std::vector<int> ascending;
+    MagicalContainer::AscendingIterator ascIter(container);
+    for (auto it = ascIter.begin(); it != ascIter.end(); ++it)
+    {
+        ascending.push_back(*it);
+    }
+    CHECK_EQ(ascending.size(), 50);
+    CHECK_EQ(ascending.front(), 4);
+    CHECK_EQ(ascending.back(), 13);
+
+    container.addElement(2);
+    container.addElement(2);
+    std::vector<int> cross;
+    MagicalContainer::SideCrossIterator crossIter(container);
+    for (auto it = crossIter.begin(); it != crossIter.end(); ++it)
+    {
+        cross.push_back(*it);
+        if (cross.size() == 4)
+        {
+            break;
+        }
+    }
+    CHECK(cross == std::vector<int>{2, 13, 2, 4});
+
+    std::vector<int> primes;
+    MagicalContainer::PrimeIterator primeIter(container);
+    for (auto it = primeIter.begin(); it != primeIter.end(); ++it)
+    {
+        primes.push_back(*it);
+    }
+    CHECK(primes == std::vector<int>{2, 2, 13});
+
+    // Expanding back into a vector keeps every copy
+    CHECK_EQ(container.getElemnets().size(), 52);
+    CHECK(container.getRepresentation() == MagicalContainer::Representation::Vector);
+}
+
+TEST_CASE("MagicalContainer: dense bitmap representation")
+{
+    MagicalContainer container;
+    for (int i = 0; i < 4096; ++i)
+    {
+        container.addElement(4095 - i);
+    }
+
+    // Distinct values in a small range switch to a bitmap on the first traversal
+    MagicalContainer::AscendingIterator ascIter(container);
+    CHECK(container.getRepresentation() == MagicalContainer::Representation::DenseBitmap);
+    CHECK_EQ(*ascIter, 0);
+    ++ascIter;
+    CHECK_EQ(*ascIter, 1);
+
+    std::vector<int> primes;
+    MagicalContainer::PrimeIterator primeIter(container);
+    for (auto it = primeIter.begin(); it != primeIter.end() && primes.size() < 5; ++it)
+    {
+        primes.push_back(*it);
+    }
+    CHECK(primes == std::vector<int>{2, 3, 5, 7, 11});
+
+    CHECK_EQ(container.countInRange(100, 199), 100);
+    container.removeElement(150);
+    CHECK_EQ(container.countInRange(100, 199), 99);
+    CHECK_THROWS_AS(container.removeElement(150), std::runtime_error);
+
+    // The bitmap grows to cover nearby values
+    container.addElement(5000);
+    CHECK(container.getRepresentation() == MagicalContainer::Representation::DenseBitmap);
+    CHECK_EQ(container.size(), 4096);
+
+    // A repeated value needs the vector layout again
+    container.addElement(7);
+    CHECK(container.getRepresentation() == MagicalContainer::Representation::Vector);
+    CHECK_EQ(container.size(), 4097);
+    CHECK_EQ(container.countInRange(7, 7), 2);
+    CHECK_THROWS_AS(container.setRepresentation(MagicalContainer::Representation::DenseBitmap), std::invalid_argument);
+}
+
+TEST_CASE("MagicalContainer: roaring representation")
+{
+    MagicalContainer container;
+    container.setRepresentation(MagicalContainer::Representation::Roaring);
+    for (int i = 0; i < 10000; ++i)
+    {
+        container.addElement(1000000 + i); // A dense cluster stored as a run
+        container.addElement(-7 * i);      // A sparse cluster stored as arrays
+    }
+    container.compact();
+    CHECK_EQ(container.size(), 20000);
+    CHECK(container.contains(1005000));
+    CHECK(container.contains(-70));
+    CHECK_FALSE(container.contains(-71));
+    CHECK_EQ(container.countInRange(1000000, 1000999), 1000);
+    CHECK_EQ(container.countInRange(-70, 0), 11);
+
+    container.removeElement(1005000);
+    CHECK_FALSE(container.contains(1005000));
+    CHECK_THROWS_AS(container.removeElement(1005000), std::runtime_error);
+
+    MagicalContainer::SideCrossIterator crossIter(container);
+    CHECK_EQ(*crossIter, -69993);
+    ++crossIter;
+    CHECK_EQ(*crossIter, 1009999);
+
+    // Iterators share one index while the container is unchanged
+    MagicalContainer::AscendingIterator ascIter(container);
+    MagicalContainer::AscendingIterator ascEnd = ascIter.end();
+    size_t count = 0;
+    for (auto it = ascIter.begin(); it != ascEnd; ++it)
+    {
+        ++count;
+    }
+    CHECK_EQ(count, 19999);
+
+    container.addElement(1000000);
+    CHECK(container.getRepresentation() == MagicalContainer::Representation::Vector);
+    CHECK_EQ(container.countInRange(1000000, 1000000), 2);
+}
+
+TEST_CASE("MagicalContainer: packed sorted index")
+{
+    PackedSortedIndex packed;
+    for (int i = 0; i < 1000; ++i)
+    {
+        packed.append(i * 3);
+    }
+    packed.finish();
+    CHECK_EQ(packed.size(), 1000);
+    CHECK_EQ(packed.blockCount(), 8);
+    CHECK_EQ(packed.lastOf(0), 381);
+    CHECK_EQ(packed.delta(1, 5), 3);
+    CHECK_EQ(packed.findBlock(382), 1);
+    CHECK(packed.byteSize() < 1000 * sizeof(int));
+
+    MagicalContainer container;
+    container.setIndexCompression(true);
+    container.addElement(std::numeric_limits<int>::max());
+    container.addElement(-5);
+    container.addElement(7);
+    container.addElement(7);
+    container.addElement(std::numeric_limits<int>::min());
+
+    std::vector<int> cross;
+    MagicalContainer::SideCrossIterator crossIter(container);
+    for (auto it = crossIter.begin(); it != crossIter.end(); ++it)
+    {
+        cross.push_back(*it);
+    }
+    CHECK(cross == std::vector<int>{std::numeric_limits<int>::min(), std::numeric_limits<int>::max(), -5, 7, 7});
+
+    std::vector<int> primes;
+    MagicalContainer::PrimeIterator primeIter(container);
+    for (auto it = primeIter.begin(); it != primeIter.end(); ++it)
+    {
+        primes.push_back(*it);
+    }
+    CHECK(primes == std::vector<int>{7, 7, std::numeric_limits<int>::max()});
+}
+
+TEST_CASE("MagicalContainer: custom allocator")
+{
+    // The arena has no upstream, so anything it cannot serve throws instead of reaching the heap
+    static std::byte buffer[1 << 20];
+    std::pmr::monotonic_buffer_resource arena(buffer, sizeof(buffer), std::pmr::null_memory_resource());
+    ariel::pmr::MagicalContainer container(&arena);
+    CHECK_EQ(container.get_allocator().resource(), &arena);
+
+    for (int i = 2000; i > 0; --i)
+    {
+        container.addElement(i);
+    }
+    container.removeElement(4);
+
+    std::vector<int> primes;
+    ariel::pmr::MagicalContainer::PrimeIterator primeIter(container);
+    for (auto it = primeIter.begin(); it != primeIter.end(); ++it)
+    {
+        primes.push_back(*it);
+    }
+    CHECK_EQ(primes.size(), 303);
+    CHECK_EQ(primes.front(), 2);
+    CHECK_EQ(primes.back(), 1999);
+
+    container.setIndexCompression(true);
+    container.setRepresentation(ariel::pmr::MagicalContainer::Representation::Roaring);
+    ariel::pmr::MagicalContainer::SideCrossIterator crossIter(container);
+    auto cross = crossIter.begin();
+    CHECK_EQ(*cross, 1);
+    CHECK_EQ(*++cross, 2000);
+    CHECK_EQ(*++cross, 2);
+    CHECK_EQ(*++cross, 1999);
+
+    container.setRepresentation(ariel::pmr::MagicalContainer::Representation::RunLength);
+    CHECK_EQ(container.size(), 1999);
+    CHECK_EQ(container.countInRange(1, 10), 9);
+    CHECK_FALSE(container.contains(4));
+}
+
+TEST_CASE("MagicalContainer: pooled index buffers")
+{
+    MagicalContainer container;
+    for (int i = 0; i < 100; ++i)
+    {
+        container.addElement(i);
+    }
+
+    for (int round = 0; round < 10; ++round)
+    {
+        container.addElement(round);
+        MagicalContainer::AscendingIterator ascIter(container);
+        size_t count = 0;
+        for (auto it = ascIter.begin(); it != ascIter.end(); ++it)
+        {
+            ++count;
+        }
+        CHECK_EQ(count, 101 + round);
+    }
+    // Only the first rebuild allocates; later ones refill the index the last iterators let go of
+    CHECK_EQ(container.getIndexPoolStats().misses, 1);
+    CHECK_EQ(container.getIndexPoolStats().hits, 9);
+
+    // An index still held by an iterator is never refilled underneath it
+    MagicalContainer::AscendingIterator held(container);
+    container.addElement(-1);
+    MagicalContainer::AscendingIterator fresh(container);
+    CHECK_EQ(*held, 0);
+    CHECK_EQ(*fresh, -1);
+    CHECK_EQ(container.getIndexPoolStats().misses, 2);
+}
+
+namespace
+{
+    // Default memory resource that counts the allocations reaching it
+    class CountingResource : public std::pmr::memory_resource
+    {
+    public:
+        size_t allocations = 0;
+
+    private:
+        void *do_allocate(size_t bytes, size_t alignment) override
+        {
+            ++allocations;
+            return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+        }
+
+        void do_deallocate(void *pointer, size_t bytes, size_t alignment) override
+        {
+            std::pmr::new_delete_resource()->deallocate(pointer, bytes, alignment);
+        }
+
+        bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override
+        {
+            return this == &other;
+        }
+    };
+}
+
+TEST_CASE("MagicalContainer: small-buffer and fixed-capacity variants")
+{
+    for (size_t count = 0; count <= SortingNetworkLimit; ++count)
+    {
+        std::vector<int> values;
+        for (size_t i = 0; i < count; ++i)
+        {
+            values.push_back(static_cast<int>((i * 7919) % 13) - 6);
+        }
+        std::vector<int> expected = values;
+        std::sort(expected.begin(), expected.end());
+        networkSort(values.data(), values.size(), std::less<int>());
+        CHECK(values == expected);
+    }
+
+    CountingResource counting;
+    std::pmr::memory_resource *previous = std::pmr::set_default_resource(&counting);
+    {
+        SmallMagicalContainer<> small;
+        for (int i = 20; i > 0; --i)
+        {
+            small.addElement(i);
+        }
+        small.removeElement(4);
+        std::vector<int> cross;
+        SmallMagicalContainer<>::SideCrossIterator crossIter(small);
+        for (auto it = crossIter.begin(); it != crossIter.end(); ++it)
+        {
+            cross.push_back(*it);
+        }
+        CHECK(cross.front() == 1);
+        CHECK(cross[1] == 20);
+        SmallMagicalContainer<>::PrimeIterator primeIter(small);
+        CHECK_EQ(*primeIter.begin(), 2);
+        size_t heapBefore = counting.allocations;
+
+        SmallMagicalContainer<> copy = small;
+        CHECK_EQ(copy.size(), 19);
+        CHECK_EQ(counting.allocations, heapBefore);
+
+        // Growing past the inline buffer spills to the default resource
+        for (int i = 0; i < 1000; ++i)
+        {
+            small.addElement(1000 + i);
+        }
+        CHECK(counting.allocations > heapBefore);
+        CHECK_EQ(small.size(), 1019);
+        CHECK_EQ(copy.size(), 19);
+    }
+    std::pmr::set_default_resource(previous);
+
+    FixedMagicalContainer<8> fixed;
+    fixed.addElement(14);
+    fixed.addElement(2);
+    fixed.addElement(5);
+    fixed.addElement(1);
+    fixed.addElement(4);
+    std::vector<int> ascending;
+    FixedMagicalContainer<8>::AscendingIterator ascIter(fixed);
+    for (auto it = ascIter.begin(); it != ascIter.end(); ++it)
+    {
+        ascending.push_back(*it);
+    }
+    CHECK(ascending == std::vector<int>{1, 2, 4, 5, 14});
+    std::vector<int> cross;
+    FixedMagicalContainer<8>::SideCrossIterator crossIter(fixed);
+    for (auto it = crossIter.begin(); it != crossIter.end(); ++it)
+    {
+        cross.push_back(*it);
+    }
+    CHECK(cross == std::vector<int>{1, 14, 2, 5, 4});
+    std::vector<int> primes;
+    FixedMagicalContainer<8>::PrimeIterator primeIter(fixed);
+    for (auto it = primeIter.begin(); it != primeIter.end(); ++it)
+    {
+        primes.push_back(*it);
+    }
+    CHECK(primes == std::vector<int>{2, 5});
+
+    fixed.removeElement(14);
+    CHECK_THROWS_AS(fixed.removeElement(14), std::runtime_error);
+    for (int i = 0; i < 4; ++i)
+    {
+        fixed.addElement(i);
+    }
+    CHECK_THROWS_AS(fixed.addElement(9), std::length_error);
+    CHECK_EQ(fixed.size(), FixedMagicalContainer<8>::capacity());
+
+    FixedMagicalContainer<8> other;
+    FixedMagicalContainer<8>::AscendingIterator otherIter(other);
+    CHECK_THROWS_AS(ascIter = otherIter, std::runtime_error);
+}
+
+TEST_CASE("MagicalContainer: reserve and steady-state mode")
+{
+    MagicalContainer container;
+    container.reserve(1000);
+    CHECK(container.capacity() >= 1000);
+
+    std::vector<std::string> allocations;
+    container.setSteadyStateMode(true, [&](const char *operation)
+                                 { allocations.emplace_back(operation); });
+    for (int i = 0; i < 1000; ++i)
+    {
+        container.addElement(i);
+        if (i % 100 == 99)
+        {
+            MagicalContainer::AscendingIterator ascIter(container);
+            MagicalContainer::PrimeIterator primeIter(container);
+            CHECK_EQ(*ascIter, 0);
+            CHECK_EQ(*primeIter, 2);
+            container.removeElement(i);
+            container.addElement(i);
+        }
+    }
+    CHECK(allocations.empty());
+    // Automatic representation changes wait until steady-state mode ends
+    CHECK(container.getRepresentation() == MagicalContainer::Representation::Vector);
+
+    container.addElement(1000);
+    CHECK_EQ(allocations, std::vector<std::string>{"addElement"});
+    container.setSteadyStateMode(false);
+
+    container.removeElement(1000);
+    container.shrink_to_fit();
+    CHECK_EQ(container.capacity(), container.size());
+}
+
+TEST_CASE("MagicalContainer: adopt, release and view")
+{
+    std::vector<int> source{14, 2, 5, 1, 4};
+    const int *buffer = source.data();
+    MagicalContainer container(std::move(source));
+    CHECK_EQ(container.size(), 5);
+    CHECK_EQ(container.view().data(), buffer);
+
+    MagicalContainer::AscendingIterator ascIter(container);
+    CHECK_EQ(*ascIter, 1);
+
+    std::vector<int> released = container.release();
+    CHECK_EQ(released.data(), buffer);
+    CHECK(released == std::vector<int>{14, 2, 5, 1, 4});
+    CHECK_EQ(container.size(), 0);
+    // Iterators keep the order they were built from
+    CHECK_EQ(*ascIter, 1);
+
+    released.push_back(7);
+    buffer = released.data();
+    container.adopt(std::move(released));
+    container.removeElement(2);
+    std::span<const int> view = container.view();
+    CHECK(std::vector<int>(view.begin(), view.end()) == std::vector<int>{14, 5, 1, 4, 7});
+
+    container.setRepresentation(MagicalContainer::Representation::RunLength);
+    view = container.view();
+    CHECK(std::vector<int>(view.begin(), view.end()) == std::vector<int>{1, 4, 5, 7, 14});
+    CHECK(container.getRepresentation() == MagicalContainer::Representation::Vector);
+}
+
+TEST_CASE("MagicalContainer: integral element types")
+{
+    BasicMagicalContainer<int64_t> ids;
+    const int64_t bigPrime = 9223372036854775783LL; // Largest prime below 2^63
+    ids.addElement(bigPrime);
+    ids.addElement(int64_t{1} << 40);
+    ids.addElement(-3);
+    ids.addElement(4294967311LL); // Smallest prime above 2^32
+    ids.addElement(3215031751LL); // Strong pseudoprime to bases 2, 3, 5 and 7
+
+    std::vector<int64_t> ascending;
+    BasicMagicalContainer<int64_t>::AscendingIterator ascIter(ids);
+    for (auto it = ascIter.begin(); it != ascIter.end(); ++it)
+    {
+        ascending.push_back(*it);
+    }
+    CHECK(ascending == std::vector<int64_t>{-3, 3215031751LL, 4294967311LL, int64_t{1} << 40, bigPrime});
+
+    std::vector<int64_t> primes;
+    BasicMagicalContainer<int64_t>::PrimeIterator primeIter(ids);
+    for (auto it = primeIter.begin(); it != primeIter.end(); ++it)
+    {
+        primes.push_back(*it);
+    }
+    CHECK(primes == std::vector<int64_t>{4294967311LL, bigPrime});
+    CHECK_THROWS_AS(ids.setRepresentation(BasicMagicalContainer<int64_t>::Representation::Roaring), std::invalid_argument);
+    CHECK_THROWS_AS(ids.setIndexCompression(true), std::invalid_argument);
+
+    // Enough keys for the radix sort, above the int range
+    BasicMagicalContainer<uint32_t> keys;
+    for (uint32_t i = 0; i < 1000; ++i)
+    {
+        keys.addElement(4294967295U - i * 7919U % 1000U);
+        keys.addElement(i);
+    }
+    CHECK_EQ(keys.countInRange(4294966296U, 4294967295U), 1000);
+    std::vector<uint32_t> cross;
+    BasicMagicalContainer<uint32_t>::SideCrossIterator crossIter(keys);
+    for (auto it = crossIter.begin(); it != crossIter.end(); ++it)
+    {
+        cross.push_back(*it);
+    }
+    CHECK_EQ(cross.size(), 2000);
+    CHECK_EQ(cross[0], 0);
+    CHECK_EQ(cross[1], 4294967295U);
+    CHECK_EQ(cross[2], 1);
+    CHECK_EQ(cross[1999], 4294966296U);
+    CHECK(MagicalContainer::PrimeIterator::isPrime(2147483647));
+    CHECK_FALSE(MagicalContainer::PrimeIterator::isPrime(2147483647 - 2));
+}
+
+namespace
+{
+    struct EvenElements
+    {
+        bool operator()(int element) const
+        {
+            return element % 2 == 0;
+        }
+    };
+
+    // Largest first: every element is taken from the back
+    struct FromTheBackOrder
+    {
+        static constexpr bool takesFront(size_t)
+        {
+            return false;
+        }
+    };
+
+    template <typename Iterator>
+    std::vector<int> collect(Iterator iter)
+    {
+        std::vector<int> values;
+        for (auto it = iter.begin(); it != iter.end(); ++it)
+        {
+            values.push_back(*it);
+        }
+        return values;
+    }
+}
+
+TEST_CASE("MagicalContainer: policy-based iterators")
+{
+    CHECK(std::is_same_v<MagicalContainer::PrimeIterator, MagicalContainer::OrderedIterator<AscendingOrder, PrimeElements>>);
+
+    MagicalContainer container;
+    for (int i = 10; i >= 1; --i)
+    {
+        container.addElement(i);
+    }
+    CHECK(collect(MagicalContainer::OrderedIterator<AscendingOrder, EvenElements>(container)) == std::vector<int>{2, 4, 6, 8, 10});
+    CHECK(collect(MagicalContainer::OrderedIterator<SideCrossOrder, EvenElements>(container)) == std::vector<int>{2, 10, 4, 8, 6});
+    CHECK(collect(MagicalContainer::OrderedIterator<FromTheBackOrder>(container)) == std::vector<int>{10, 9, 8, 7, 6, 5, 4, 3, 2, 1});
+    CHECK(collect(MagicalContainer::OrderedIterator<FromTheBackOrder, PrimeElements>(container)) == std::vector<int>{7, 5, 3, 2});
+
+    // A user filter's index is cached like the built-in ones until the container changes
+    size_t misses = container.getIndexPoolStats().misses;
+    MagicalContainer::OrderedIterator<AscendingOrder, EvenElements> evens(container);
+    CHECK_EQ(container.getIndexPoolStats().misses, misses);
+    container.addElement(12);
+    CHECK(collect(evens) == std::vector<int>{2, 4, 6, 8, 10, 12});
+    CHECK_EQ(*evens, 2);
+}
+
+namespace
+{
+    // Counts its calls, to show which operations evaluate a registered filter
+    struct CountedMultiplesOfThree
+    {
+        static inline size_t calls = 0;
+
+        bool operator()(int element) const
+        {
+            ++calls;
+            return element % 3 == 0;
+        }
+    };
+
+    constexpr bool isOdd(int element)
+    {
+        return element % 2 != 0;
+    }
+}
+
+TEST_CASE("MagicalContainer: filter iterators")
+{
+    MagicalContainer container;
+    for (int i = 1; i <= 20; ++i)
+    {
+        container.addElement(i);
+    }
+    CHECK(collect(MagicalContainer::FilterIterator<FunctionFilter<isOdd>>(container)) == std::vector<int>{1, 3, 5, 7, 9, 11, 13, 15, 17, 19});
+    CHECK(collect(MagicalContainer::FilterIterator<EvenElements>(container)) == std::vector<int>{2, 4, 6, 8, 10, 12, 14, 16, 18, 20});
+
+    // A registered filter is called once per change, never over all the elements again
+    container.registerFilter<CountedMultiplesOfThree>();
+    CountedMultiplesOfThree::calls = 0;
+    container.addElement(30);
+    container.addElement(30);
+    container.removeElement(6);
+    container.removeElement(30, MagicalContainer::RemovalScope::One);
+    CHECK_THROWS_AS(container.removeElement(99), std::runtime_error);
+    CHECK(collect(MagicalContainer::FilterIterator<CountedMultiplesOfThree>(container)) == std::vector<int>{3, 9, 12, 15, 18, 30});
+    CHECK_EQ(CountedMultiplesOfThree::calls, 4);
+
+    // Wholesale changes gather the matches again, through any representation
+    std::vector<int> replacement{9, 4, 3, 3, 10};
+    container.Setelements(replacement);
+    CHECK(collect(MagicalContainer::FilterIterator<CountedMultiplesOfThree>(container)) == std::vector<int>{3, 3, 9});
+    container.setRepresentation(MagicalContainer::Representation::RunLength);
+    container.removeElement(3);
+    CHECK(collect(MagicalContainer::FilterIterator<CountedMultiplesOfThree>(container)) == std::vector<int>{9});
+    container.getElemnets().push_back(21);
+    CHECK(collect(MagicalContainer::FilterIterator<CountedMultiplesOfThree>(container)) == std::vector<int>{9, 21});
+    container.setRepresentation(MagicalContainer::Representation::RunLength);
+    container.addElement(6);
+    CHECK(collect(MagicalContainer::FilterIterator<CountedMultiplesOfThree>(container)) == std::vector<int>{6, 9, 21});
+
+    // Unregistered filters test every element again
+    container.unregisterFilter<CountedMultiplesOfThree>();
+    CountedMultiplesOfThree::calls = 0;
+    container.addElement(12);
+    CHECK(collect(MagicalContainer::FilterIterator<CountedMultiplesOfThree>(container)) == std::vector<int>{6, 9, 12, 21});
+    CHECK_EQ(CountedMultiplesOfThree::calls, 6);
+}
+
+TEST_CASE("MagicalContainer: checked and unchecked iterators")
+{
+    using Checked = MagicalContainer::OrderedIterator<AscendingOrder, AllElements, CheckedIterators>;
+    using Unchecked = MagicalContainer::OrderedIterator<AscendingOrder, AllElements, UncheckedIterators>;
+    CHECK(std::is_same_v<MagicalContainer::AscendingIterator, Checked>); // make test builds without NDEBUG
+
+    MagicalContainer first;
+    MagicalContainer second;
+    first.addElement(3);
+    first.addElement(1);
+    second.addElement(2);
+
+    Checked checked(first);
+    Checked other(second);
+    CHECK_THROWS_AS((void)(checked == other), std::runtime_error);
+    CHECK_THROWS_AS((void)(checked < other), std::runtime_error);
+    CHECK_THROWS_AS(checked = Checked(second), std::runtime_error);
+    Checked end = checked.end();
+    CHECK_THROWS_AS((void)*end, std::runtime_error);
+    CHECK_THROWS_AS(++end, std::runtime_error);
+
+    // Unchecked iterators leave misuse to the caller but behave the same when used correctly
+    Unchecked unchecked(first);
+    Unchecked unrelated(second);
+    CHECK_FALSE(unchecked == unrelated);
+    unrelated = unchecked;
+    CHECK(unrelated == unchecked);
+    CHECK(collect(unchecked) == std::vector<int>{1, 3});
+}
+
+TEST_CASE("MagicalContainer: descending and bidirectional iterators")
+{
+    MagicalContainer container;
+    for (int element : {5, 1, 9, 5, 3, 7, 2})
+    {
+        container.addElement(element);
+    }
+    CHECK(collect(MagicalContainer::DescendingIterator(container)) == std::vector<int>{9, 7, 5, 5, 3, 2, 1});
+
+    // Top three without touching the rest
+    MagicalContainer::DescendingIterator largest(container);
+    std::vector<int> top;
+    for (auto it = largest.begin(); top.size() < 3; ++it)
+    {
+        top.push_back(*it);
+    }
+    CHECK(top == std::vector<int>{9, 7, 5});
+
+    // Walking back from end() visits every order in reverse
+    auto reversed = [](auto iter)
+    {
+        std::vector<int> values;
+        for (auto it = iter.end(); it != iter.begin();)
+        {
+            --it;
+            values.push_back(*it);
+        }
+        return values;
+    };
+    CHECK(reversed(MagicalContainer::AscendingIterator(container)) == std::vector<int>{9, 7, 5, 5, 3, 2, 1});
+    CHECK(reversed(MagicalContainer::SideCrossIterator(container)) == std::vector<int>{5, 5, 3, 7, 2, 9, 1});
+    CHECK(reversed(MagicalContainer::PrimeIterator(container)) == std::vector<int>{7, 5, 5, 3, 2});
+    CHECK(reversed(MagicalContainer::DescendingIterator(container)) == std::vector<int>{1, 2, 3, 5, 5, 7, 9});
+
+    // Back and forth in the middle of a cross walk
+    MagicalContainer::SideCrossIterator cross(container);
+    ++cross;
+    ++cross;
+    ++cross;
+    CHECK_EQ(*cross, 7);
+    --cross;
+    CHECK_EQ(*cross, 2);
+    ++cross;
+    ++cross;
+    CHECK_EQ(*cross, 3);
+
+    CHECK(reversed(MagicalContainer::OrderedIterator<FromTheBackOrder>(container)) == std::vector<int>{1, 2, 3, 5, 5, 7, 9});
+    CHECK_THROWS_AS(--MagicalContainer::AscendingIterator(container), std::runtime_error);
+
+    // Packed indexes span several blocks here
+    MagicalContainer large;
+    for (int i = 0; i < 1000; ++i)
+    {
+        large.addElement(i * 37 % 1000);
+    }
+    std::vector<int> forward = collect(MagicalContainer::SideCrossIterator(large));
+    std::reverse(forward.begin(), forward.end());
+    CHECK(reversed(MagicalContainer::SideCrossIterator(large)) == forward);
+    large.setIndexCompression(true);
+    CHECK(reversed(MagicalContainer::SideCrossIterator(large)) == forward);
+    CHECK_EQ(reversed(MagicalContainer::DescendingIterator(large)).back(), 999);
+}
+
+TEST_CASE("MagicalContainer: lazy ascending order")
+{
+    MagicalContainer container;
+    std::vector<int> sorted;
+    for (int i = 0; i < 2000; ++i)
+    {
+        int element = i * 7919 % 1000; // Every value twice
+        container.addElement(element);
+        sorted.push_back(element);
+    }
+    std::sort(sorted.begin(), sorted.end());
+    CHECK_THROWS_AS(container.setLazySorting(true, 1.5), std::invalid_argument);
+    container.setLazySorting(true, 0.05);
+
+    // The ten smallest, then a second reader that goes past the point where the rest gets sorted
+    MagicalContainer::AscendingIterator smallest(container);
+    std::vector<int> top;
+    for (auto it = smallest.begin(); top.size() < 10; ++it)
+    {
+        top.push_back(*it);
+    }
+    CHECK(top == std::vector<int>{0, 0, 1, 1, 2, 2, 3, 3, 4, 4});
+    CHECK(collect(MagicalContainer::AscendingIterator(container)) == sorted);
+
+    // Other orders complete a partly read index
+    container.addElement(5000);
+    MagicalContainer::AscendingIterator partial(container);
+    ++partial;
+    ++partial;
+    CHECK_EQ(*partial, 1);
+    MagicalContainer::SideCrossIterator cross(container);
+    CHECK_EQ(*++cross, 5000);
+    ++partial;
+    CHECK_EQ(*partial, 1);
+    --partial;
+    --partial;
+    CHECK_EQ(*partial, 0);
+    auto last = partial.end();
+    --last;
+    CHECK_EQ(*last, 5000);
+    CHECK(collect(MagicalContainer::DescendingIterator(container)).front() == 5000);
+}
+
+TEST_CASE("MagicalContainer: min-max heap cross order and popMin/popMax")
+{
+    MagicalContainer container;
+    std::vector<int> sorted;
+    for (int i = 0; i < 3000; ++i)
+    {
+        int element = i * 7919 % 1500;
+        container.addElement(element);
+        sorted.push_back(element);
+    }
+    std::sort(sorted.begin(), sorted.end());
+    container.setLazySorting(true, 0.01);
+
+    // Early exit from both ends of a lazily built index
+    MagicalContainer::SideCrossIterator cross(container);
+    std::vector<int> ends;
+    for (auto it = cross.begin(); ends.size() < 6; ++it)
+    {
+        ends.push_back(*it);
+    }
+    CHECK(ends == std::vector<int>{0, 1499, 0, 1499, 1, 1498});
+    CHECK_EQ(*MagicalContainer::DescendingIterator(container), 1499);
+
+    // Reading on past the eager point sorts the middle without disturbing the cursors already in use
+    std::vector<int> forward = collect(MagicalContainer::SideCrossIterator(container));
+    CHECK_EQ(forward.size(), 3000);
+    CHECK_EQ(forward[2998], sorted[1499]);
+    CHECK_EQ(forward[2999], sorted[1500]);
+    CHECK(collect(MagicalContainer::AscendingIterator(container)) == sorted);
+    ++cross;
+    CHECK_EQ(*cross, 1499);
+    ++cross;
+    CHECK_EQ(*cross, 0);
+
+    // Queue-style consumers
+    MagicalContainer queue;
+    for (int element : {8, 3, 9, 1, 3, 7})
+    {
+        queue.addElement(element);
+    }
+    CHECK_EQ(queue.popMin(), 1);
+    CHECK_EQ(queue.popMax(), 9);
+    queue.addElement(0);
+    queue.addElement(10);
+    CHECK_EQ(queue.popMin(), 0);
+    CHECK_EQ(queue.popMin(), 3);
+    CHECK_EQ(queue.popMax(), 10);
+    queue.removeElement(8);
+    CHECK_EQ(queue.popMax(), 7);
+    CHECK_EQ(queue.popMax(), 3);
+    CHECK_EQ(queue.size(), 0);
+    CHECK_THROWS_AS(queue.popMin(), std::runtime_error);
+
+    queue.setRepresentation(MagicalContainer::Representation::RunLength);
+    queue.addElement(4);
+    queue.addElement(4);
+    queue.addElement(2);
+    CHECK_EQ(queue.popMax(), 4);
+    CHECK_EQ(queue.popMin(), 2);
+    CHECK_EQ(queue.size(), 1);
+
+    // Pops keep registered filter matches current
+    container.registerFilter<EvenElements>();
+    CHECK_EQ(container.popMin(), 0);
+    CHECK_EQ(container.popMin(), 0);
+    CHECK_EQ(container.popMax(), 1499);
+    CHECK_EQ(*MagicalContainer::FilterIterator<EvenElements>(container), 2);
+}
+
+TEST_CASE("MagicalContainer: min and max")
+{
+    MagicalContainer container;
+    CHECK_THROWS_AS((void)container.min(), std::runtime_error);
+    for (int element : {5, 2, 9, 2, 7})
+    {
+        container.addElement(element);
+    }
+    CHECK_EQ(container.min(), 2);
+    CHECK_EQ(container.max(), 9);
+
+    // Only removing an extreme forgets it; removing one copy of a repeated extreme keeps the value
+    container.removeElement(7);
+    CHECK_EQ(container.max(), 9);
+    container.removeElement(2, MagicalContainer::RemovalScope::One);
+    CHECK_EQ(container.min(), 2);
+    container.removeElement(9);
+    CHECK_EQ(container.max(), 5);
+    CHECK_EQ(container.popMin(), 2);
+    CHECK_EQ(container.min(), 5);
+    container.addElement(-4);
+    CHECK_EQ(container.min(), -4);
+    CHECK_EQ(*MagicalContainer::SideCrossIterator(container), container.min());
+
+    std::vector<int> replacement{40, 10, 30};
+    container.Setelements(replacement);
+    CHECK_EQ(container.min(), 10);
+    CHECK_EQ(container.max(), 40);
+    container.getElemnets().push_back(50);
+    CHECK_EQ(container.max(), 50);
+
+    for (auto representation : {MagicalContainer::Representation::RunLength, MagicalContainer::Representation::DenseBitmap,
+                                MagicalContainer::Representation::Roaring})
+    {
+        container.setRepresentation(representation);
+        container.removeElement(10);
+        CHECK_EQ(container.min(), 30);
+        container.addElement(10);
+        CHECK_EQ(container.min(), 10);
+        CHECK_EQ(container.max(), 50);
+    }
+    container.setRemovalMode(MagicalContainer::RemovalMode::Tombstone);
+    container.setRepresentation(MagicalContainer::Representation::Vector);
+    container.removeElement(50);
+    CHECK_EQ(container.max(), 40);
+}
+
+TEST_CASE("MagicalContainer: seek and seekPosition")
+{
+    MagicalContainer container;
+    for (int i = 0; i < 600; ++i)
+    {
+        container.addElement(i * 3 % 1000);
+    }
+
+    MagicalContainer::AscendingIterator ascending(container);
+    CHECK_EQ(*ascending.seek(100), 101);
+    CHECK_EQ(*ascending.seek(50), 101); // Never moves back
+    auto it = ascending.begin();
+    it.seek(0);
+    CHECK(it == ascending.begin());
+    it.seek(1000);
+    CHECK(it == ascending.end());
+
+    // Agrees with stepping, from every starting point
+    std::vector<int> all = collect(ascending);
+    auto stepped = ascending.begin();
+    for (int target = 0; target < 1000; target += 37)
+    {
+        auto sought = stepped;
+        sought.seek(target);
+        auto expected = std::lower_bound(all.begin(), all.end(), target);
+        if (expected == all.end())
+        {
+            CHECK(sought == ascending.end());
+            continue;
+        }
+        CHECK_EQ(*sought, *expected);
+        ++sought;
+        ++expected;
+        if (expected != all.end())
+        {
+            CHECK_EQ(*sought, *expected);
+        }
+        stepped.seek(target / 2);
+    }
+
+    // Merge join of two containers, skipping ahead in whichever is behind
+    MagicalContainer fives;
+    for (int i = 0; i < 200; ++i)
+    {
+        fives.addElement(i * 5);
+    }
+    MagicalContainer::AscendingIterator left(container);
+    MagicalContainer::AscendingIterator right(fives);
+    std::vector<int> common;
+    for (auto l = left.begin(), r = right.begin(); l != left.end() && r != right.end();)
+    {
+        if (*l < *r)
+        {
+            l.seek(*r);
+        }
+        else if (*r < *l)
+        {
+            r.seek(*l);
+        }
+        else
+        {
+            common.push_back(*l);
+            l.seek(*l + 1);
+            ++r;
+        }
+    }
+    std::vector<int> distinct = all;
+    distinct.erase(std::unique(distinct.begin(), distinct.end()), distinct.end());
+    std::vector<int> expected;
+    std::vector<int> multiplesOfFive = collect(right);
+    std::set_intersection(distinct.begin(), distinct.end(), multiplesOfFive.begin(), multiplesOfFive.end(), std::back_inserter(expected));
+    CHECK(common == expected);
+
+    MagicalContainer::PrimeIterator primes(container);
+    CHECK_EQ(*primes.seek(100), 101);
+    CHECK_EQ(*primes.seek(102), 107);
+    primes.seek(1000);
+    CHECK(primes == primes.end());
+
+    // Cross order by position, over runs and packed blocks
+    for (bool compressed : {false, true})
+    {
+        container.setIndexCompression(compressed);
+        MagicalContainer::SideCrossIterator cross(container);
+        std::vector<int> order = collect(cross);
+        for (size_t position : {size_t{0}, size_t{1}, size_t{333}, size_t{598}, size_t{599}, size_t{2}})
+        {
+            CHECK_EQ(*cross.seekPosition(position), order[position]);
+        }
+        cross.seekPosition(250);
+        ++cross;
+        CHECK_EQ(*cross, order[251]);
+        --cross;
+        --cross;
+        CHECK_EQ(*cross, order[249]);
+        cross.seekPosition(order.size());
+        CHECK(cross == cross.end());
+        --cross;
+        CHECK_EQ(*cross, order.back());
+        CHECK_THROWS_AS(cross.seekPosition(order.size() + 1), std::invalid_argument);
+    }
+}
+
+TEST_CASE("MagicalContainer: pages and cursor tokens")
+{
+    MagicalContainer container;
+    for (int i = 1; i <= 50; ++i)
+    {
+        container.addElement(i * 7 % 51);
+    }
+
+    // Reading page after page, each from nothing but the previous token, gives the whole order
+    auto readAll = [&](MagicalContainer::PageOrder order, size_t limit)
+    {
+        std::vector<int> values;
+        MagicalContainer::PageToken token;
+        while (true)
+        {
+            MagicalContainer::Page page = container.page(order, token, limit);
+            CHECK(page.elements.size() <= limit);
+            values.insert(values.end(), page.elements.begin(), page.elements.end());
+            if (page.last)
+            {
+                return values;
+            }
+            token = page.next;
+        }
+    };
+    CHECK(readAll(MagicalContainer::PageOrder::Ascending, 7) == collect(MagicalContainer::AscendingIterator(container)));
+    CHECK(readAll(MagicalContainer::PageOrder::SideCross, 10) == collect(MagicalContainer::SideCrossIterator(container)));
+    CHECK(readAll(MagicalContainer::PageOrder::Prime, 4) == collect(MagicalContainer::PrimeIterator(container)));
+
+    // Rebuilding an index is only needed for the first page after a change
+    MagicalContainer::Page first = container.page(MagicalContainer::PageOrder::Ascending, MagicalContainer::PageToken(), 20);
+    CHECK(first.elements == std::vector<int>{1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20});
+    auto rebuilds = [&]
+    {
+        MagicalContainer::IndexPoolStats stats = container.getIndexPoolStats();
+        return stats.hits + stats.misses;
+    };
+    size_t built = rebuilds();
+    MagicalContainer::Page second = container.page(MagicalContainer::PageOrder::Ascending, first.next, 20);
+    CHECK_EQ(second.elements.front(), 21);
+    CHECK_EQ(rebuilds(), built);
+
+    // A change makes old tokens stale, except for the first page
+    container.addElement(100);
+    CHECK_FALSE(container.isCurrent(second.next));
+    CHECK_THROWS_AS(container.page(MagicalContainer::PageOrder::Ascending, second.next, 20), std::runtime_error);
+    CHECK_EQ(rebuilds(), built);
+    CHECK(container.isCurrent(MagicalContainer::PageToken()));
+    MagicalContainer::Page whole = container.page(MagicalContainer::PageOrder::Ascending, MagicalContainer::PageToken(), 1000);
+    CHECK(whole.last);
+    CHECK_EQ(whole.elements.size(), 51);
+    CHECK_EQ(whole.elements.back(), 100);
+}
+
+TEST_CASE("MagicalContainer: next_batch")
+{
+    MagicalContainer container;
+    for (int i = 0; i < 1000; ++i)
+    {
+        container.addElement(i * 37 % 500); // Every value twice
+    }
+
+    auto batched = [](auto iter, size_t batchSize)
+    {
+        std::vector<int> values;
+        std::vector<int> batch(batchSize);
+        for (size_t copied; (copied = iter.next_batch(batch)) != 0;)
+        {
+            values.insert(values.end(), batch.begin(), batch.begin() + static_cast<ptrdiff_t>(copied));
+        }
+        CHECK(iter == iter.end());
+        return values;
+    };
+    for (bool compressed : {false, true})
+    {
+        container.setIndexCompression(compressed);
+        for (size_t batchSize : {size_t{1}, size_t{3}, size_t{64}, size_t{5000}})
+        {
+            CHECK(batched(MagicalContainer::AscendingIterator(container), batchSize) == collect(MagicalContainer::AscendingIterator(container)));
+            CHECK(batched(MagicalContainer::SideCrossIterator(container), batchSize) == collect(MagicalContainer::SideCrossIterator(container)));
+            CHECK(batched(MagicalContainer::PrimeIterator(container), batchSize) == collect(MagicalContainer::PrimeIterator(container)));
+            CHECK(batched(MagicalContainer::DescendingIterator(container), batchSize) == collect(MagicalContainer::DescendingIterator(container)));
+        }
+    }
+    container.setIndexCompression(false);
+
+    // Batches and single steps mix, and a batch ending on the last element leaves a usable end()
+    container.setLazySorting(true);
+    MagicalContainer::AscendingIterator ascending(container);
+    std::array<int, 5> batch{};
+    CHECK_EQ(ascending.next_batch(batch), 5);
+    CHECK(batch == std::array<int, 5>{0, 0, 1, 1, 2});
+    CHECK_EQ(*ascending, 2);
+    ++ascending;
+    CHECK_EQ(*ascending, 3);
+    std::vector<int> rest(994);
+    CHECK_EQ(ascending.next_batch(rest), 994);
+    CHECK_EQ(rest.back(), 499);
+    CHECK(ascending == ascending.end());
+    CHECK_EQ(ascending.next_batch(rest), 0);
+    --ascending;
+    CHECK_EQ(*ascending, 499);
+    --ascending;
+    --ascending;
+    CHECK_EQ(*ascending, 498);
+}
+
+TEST_CASE("MagicalContainer: side-cross order in bulk")
+{
+    auto exported = [](MagicalContainer &container, size_t firstSteps, size_t batchSize)
+    {
+        MagicalContainer::SideCrossIterator cross(container);
+        std::vector<int> values;
+        for (; firstSteps != 0 && cross != cross.end(); --firstSteps, ++cross)
+        {
+            values.push_back(*cross);
+        }
+        std::vector<int> batch(batchSize);
+        for (size_t copied; (copied = cross.next_batch(batch)) != 0;)
+        {
+            values.insert(values.end(), batch.begin(), batch.begin() + static_cast<ptrdiff_t>(copied));
+        }
+        CHECK(cross == cross.end());
+        return values;
+    };
+
+    for (int length : {1, 2, 3, 4, 7, 600, 1201})
+    {
+        for (bool lazy : {false, true})
+        {
+            MagicalContainer container;
+            container.setLazySorting(lazy);
+            for (int i = 0; i < length; ++i)
+            {
+                container.addElement(i * 7919 % 1000 - (i % 3 == 0 ? 0 : 500)); // Duplicates and negatives
+            }
+            std::vector<int> expected = collect(MagicalContainer::SideCrossIterator(container));
+            for (size_t firstSteps : {size_t{0}, size_t{1}, size_t{2}})
+            {
+                for (size_t batchSize : {size_t{1}, size_t{2}, size_t{5}, size_t{513}, size_t{4096}})
+                {
+                    CHECK(exported(container, firstSteps, batchSize) == expected);
+                }
+            }
+        }
+    }
+
+    // Stepping back after a bulk export retraces the order
+    MagicalContainer container;
+    for (int i = 1; i <= 9; ++i)
+    {
+        container.addElement(i);
+    }
+    MagicalContainer::SideCrossIterator cross(container);
+    std::array<int, 4> batch{};
+    CHECK_EQ(cross.next_batch(batch), 4);
+    CHECK(batch == std::array<int, 4>{1, 9, 2, 8});
+    CHECK_EQ(*cross, 3);
+    --cross;
+    CHECK_EQ(*cross, 8);
+    ++cross;
+    std::array<int, 9> rest{};
+    CHECK_EQ(cross.next_batch(rest), 5);
+    CHECK(std::equal(rest.begin(), rest.begin() + 5, std::array<int, 5>{3, 7, 4, 6, 5}.begin()));
+    --cross;
+    CHECK_EQ(*cross, 5);
+    --cross;
+    CHECK_EQ(*cross, 6);
+}
+
+TEST_CASE("MagicalContainer: prime index through stream compaction")
+{
+    auto trialDivision = [](int64_t value)
+    {
+        if (value < 2)
+        {
+            return false;
+        }
+        for (int64_t divisor = 2; divisor * divisor <= value; ++divisor)
+        {
+            if (value % divisor == 0)
+            {
+                return false;
+            }
+        }
+        return true;
+    };
+    auto expectedPrimes = [&](MagicalContainer &container)
+    {
+        std::vector<int> primes;
+        for (int element : collect(MagicalContainer::AscendingIterator(container)))
+        {
+            if (trialDivision(element))
+            {
+                primes.push_back(element);
+            }
+        }
+        return primes;
+    };
+
+    // More than one compaction block, with small values, negatives and repeats
+    MagicalContainer container;
+    container.setAutomaticRepresentation(false);
+    container.setRemovalMode(MagicalContainer::RemovalMode::Tombstone);
+    for (int i = 0; i < 2500; ++i)
+    {
+        container.addElement(i * 7919 % 3001 - 20);
+    }
+    container.addElement(2);
+    container.addElement(2147483647);
+    container.addElement(2147483647 - 2);
+    CHECK(collect(MagicalContainer::PrimeIterator(container)) == expectedPrimes(container));
+
+    // With tombstones the elements are visited one at a time instead
+    container.removeElement(2);
+    container.removeElement(2147483647);
+    CHECK(collect(MagicalContainer::PrimeIterator(container)) == expectedPrimes(container));
+    container.compact();
+    CHECK(collect(MagicalContainer::PrimeIterator(container)) == expectedPrimes(container));
+
+    // Montgomery reduction near the top of each word width
+    using Unsigned32 = BasicMagicalContainer<uint32_t>;
+    CHECK(Unsigned32::PrimeIterator::isPrime(4294967291U)); // Largest prime below 2^32
+    CHECK(Unsigned32::PrimeIterator::isPrime(4294967279U));
+    CHECK_FALSE(Unsigned32::PrimeIterator::isPrime(4294967295U));
+    CHECK_FALSE(Unsigned32::PrimeIterator::isPrime(3215031751U)); // Strong pseudoprime to bases 2, 3, 5 and 7
+    using Unsigned64 = BasicMagicalContainer<uint64_t>;
+    CHECK(Unsigned64::PrimeIterator::isPrime(18446744073709551557ULL)); // Largest prime below 2^64
+    CHECK_FALSE(Unsigned64::PrimeIterator::isPrime(18446744073709551615ULL));
+    CHECK_FALSE(Unsigned64::PrimeIterator::isPrime(3825123056546413051ULL)); // Strong pseudoprime to the primes up to 23
+    for (int64_t value = 4294967200LL; value < 4294967400LL; ++value)
+    {
+        CHECK_EQ(BasicMagicalContainer<int64_t>::PrimeIterator::isPrime(value), trialDivision(value));
+    }
+}
+
+TEST_CASE("MagicalContainer: aggregate")
+{
+    using Aggregate = MagicalContainer::Aggregate;
+    auto expected = [](const std::vector<int> &values, Aggregate operation)
+    {
+        switch (operation)
+        {
+        case Aggregate::Sum:
+            return std::accumulate(values.begin(), values.end(), int64_t{0});
+        case Aggregate::Count:
+            return static_cast<int64_t>(values.size());
+        case Aggregate::Min:
+            return int64_t{*std::min_element(values.begin(), values.end())};
+        case Aggregate::Max:
+            break;
+        }
+        return int64_t{*std::max_element(values.begin(), values.end())};
+    };
+    auto checkAll = [&](MagicalContainer &container)
+    {
+        std::vector<int> all = collect(MagicalContainer::AscendingIterator(container));
+        std::vector<int> primes = collect(MagicalContainer::PrimeIterator(container));
+        std::vector<int> evens = collect(MagicalContainer::FilterIterator<EvenElements>(container));
+        for (Aggregate operation : {Aggregate::Sum, Aggregate::Count, Aggregate::Min, Aggregate::Max})
+        {
+            CHECK_EQ(container.aggregate(operation), expected(all, operation));
+            CHECK_EQ(container.aggregate<PrimeElements>(operation), expected(primes, operation));
+            CHECK_EQ(container.aggregate<EvenElements>(operation), expected(evens, operation));
+            CHECK_EQ(container.aggregate(MagicalContainer::PageOrder::SideCross, operation), expected(all, operation));
+            CHECK_EQ(container.aggregate(MagicalContainer::PageOrder::Prime, operation), expected(primes, operation));
+        }
+    };
+
+    // Distinct values, so every representation can hold them
+    MagicalContainer container;
+    container.setAutomaticRepresentation(false);
+    for (int i = 0; i < 3000; ++i)
+    {
+        container.addElement(i * 7919 % 3001 - 50);
+    }
+    for (auto representation : {MagicalContainer::Representation::Vector, MagicalContainer::Representation::RunLength,
+                                MagicalContainer::Representation::DenseBitmap, MagicalContainer::Representation::Roaring})
+    {
+        container.setRepresentation(representation);
+        checkAll(container);
+    }
+    container.setRepresentation(MagicalContainer::Representation::Vector);
+    container.setRemovalMode(MagicalContainer::RemovalMode::Tombstone);
+    container.removeElement(-50);
+    container.removeElement(2);
+    checkAll(container);
+
+    // The sum goes past the int range
+    MagicalContainer large;
+    for (int i = 0; i < 3; ++i)
+    {
+        large.addElement(2147483647);
+    }
+    CHECK_EQ(large.aggregate(Aggregate::Sum), int64_t{3} * 2147483647);
+    CHECK_EQ(large.aggregate<PrimeElements>(Aggregate::Count), 3);
+
+    // Nothing to take the extremes of
+    MagicalContainer empty;
+    CHECK_EQ(empty.aggregate(Aggregate::Sum), 0);
+    CHECK_EQ(empty.aggregate<PrimeElements>(Aggregate::Count), 0);
+    CHECK_THROWS_AS(empty.aggregate(Aggregate::Min), std::runtime_error);
+    empty.addElement(4);
+    CHECK_THROWS_AS(empty.aggregate<PrimeElements>(Aggregate::Max), std::runtime_error);
+    CHECK_EQ(empty.aggregate(Aggregate::Max), 4);
+
+    BasicMagicalContainer<uint64_t> wide;
+    wide.addElement(18446744073709551557ULL);
+    wide.addElement(10);
+    CHECK_EQ(wide.aggregate<PrimeElements>(BasicMagicalContainer<uint64_t>::Aggregate::Min), 18446744073709551557ULL);
+    CHECK_EQ(wide.aggregate(BasicMagicalContainer<uint64_t>::Aggregate::Sum), 18446744073709551567ULL);
+}
+
+TEST_CASE("MagicalContainer: wide elements in every removal mode")
+{
+    const int64_t big = (int64_t{1} << 33) + 5;
+    for (auto mode : {BasicMagicalContainer<int64_t>::RemovalMode::Ordered, BasicMagicalContainer<int64_t>::RemovalMode::SwapAndPop,
+                      BasicMagicalContainer<int64_t>::RemovalMode::Tombstone})
+    {
+        BasicMagicalContainer<int64_t> container;
+        container.setRemovalMode(mode);
+        container.addElement(big);
+        container.addElement(5);
+        container.addElement(7);
+        CHECK(container.contains(big));
+        CHECK_FALSE(container.contains(big + 2)); // Same low 32 bits as 7
+        container.removeElement(big);
+        CHECK_FALSE(container.contains(big));
+        CHECK(container.contains(5));
+        CHECK_EQ(container.size(), 2);
+        CHECK_THROWS_AS(container.removeElement(big), std::runtime_error);
+    }
+
+    BasicMagicalContainer<uint32_t> keys;
+    keys.setRemovalMode(BasicMagicalContainer<uint32_t>::RemovalMode::Tombstone);
+    keys.addElement(4294967295U);
+    keys.addElement(1);
+    keys.removeElement(4294967295U);
+    CHECK_FALSE(keys.contains(4294967295U));
+    CHECK(keys.contains(1));
+
+    // Back to a vector from runs, which other element types can use too
+    BasicMagicalContainer<int64_t> runs;
+    runs.addElement(big);
+    runs.addElement(big);
+    runs.setRepresentation(BasicMagicalContainer<int64_t>::Representation::RunLength);
+    CHECK_NOTHROW(runs.setRepresentation(BasicMagicalContainer<int64_t>::Representation::Vector));
+    CHECK(runs.getRepresentation() == BasicMagicalContainer<int64_t>::Representation::Vector);
+    runs.setRepresentation(BasicMagicalContainer<int64_t>::Representation::RunLength);
+    CHECK_EQ(runs.getElemnets().size(), 2);
+    CHECK_THROWS_AS(runs.setRepresentation(BasicMagicalContainer<int64_t>::Representation::Roaring), std::invalid_argument);
+}
+
+TEST_CASE("MagicalContainer: indexes built before getElemnets are dropped when it ends")
+{
+    for (auto target : {MagicalContainer::Representation::RunLength, MagicalContainer::Representation::DenseBitmap,
+                        MagicalContainer::Representation::Roaring})
+    {
+        MagicalContainer container;
+        container.addElement(575);
+        CHECK(collect(MagicalContainer::AscendingIterator(container)) == std::vector<int>{575});
+        CHECK(collect(MagicalContainer::PrimeIterator(container)).empty());
+        container.getElemnets().push_back(436);
+        container.getElemnets().push_back(433);
+        container.setRepresentation(target);
+        CHECK_EQ(container.size(), 3);
+        CHECK(collect(MagicalContainer::AscendingIterator(container)) == std::vector<int>{433, 436, 575});
+        CHECK(collect(MagicalContainer::PrimeIterator(container)) == std::vector<int>{433});
+        CHECK(collect(MagicalContainer::FilterIterator<EvenElements>(container)) == std::vector<int>{436});
+    }
+}
+
+TEST_CASE("MagicalContainer: an exposed vector is not turned into a bitmap")
+{
+    MagicalContainer container;
+    for (int i = 0; i < 2000; ++i)
+    {
+        container.addElement(i);
+    }
+    auto &elements = container.getElemnets();
+    MagicalContainer::AscendingIterator ascending(container);
+    CHECK(container.getRepresentation() == MagicalContainer::Representation::Vector);
+    elements.push_back(5000);
+    CHECK_EQ(container.size(), 2001);
+    CHECK(container.contains(5000));
+    CHECK_EQ(collect(MagicalContainer::AscendingIterator(container)).back(), 5000);
+}
+
+TEST_CASE("MagicalContainer: aggregate sums of 64-bit elements wrap around")
+{
+    using Wide = BasicMagicalContainer<int64_t>;
+    const int64_t largest = std::numeric_limits<int64_t>::max();
+    for (size_t copies : {size_t{2}, size_t{2000}})
+    {
+        Wide container;
+        for (size_t i = 0; i < copies; ++i)
+        {
+            container.addElement(largest);
+            container.addElement(-1);
+        }
+        // Each pair adds 2^63 - 2, so an even number of pairs comes to -2 * pairs modulo 2^64
+        CHECK_EQ(container.aggregate(Wide::Aggregate::Sum), -2 * static_cast<int64_t>(copies));
+        container.setRepresentation(Wide::Representation::RunLength);
+        CHECK_EQ(container.aggregate(Wide::Aggregate::Sum), -2 * static_cast<int64_t>(copies));
+        CHECK_EQ(container.aggregate(Wide::Aggregate::Max), largest);
+    }
+}
+
+TEST_CASE("MagicalContainer: packed blocks decoded whole")
+{
+    PackedSortedIndex packed;
+    std::vector<int> values;
+    for (int i = 0; i < 300; ++i)
+    {
+        values.push_back(i < 130 ? -7 : i * i * 1000); // A block of one repeated value, then wide deltas
+    }
+    for (int value : values)
+    {
+        packed.append(value);
+    }
+    packed.finish();
+    std::vector<int> decoded;
+    std::array<int, PackedSortedIndex<>::BlockSize> block{};
+    for (size_t index = 0; index < packed.blockCount(); ++index)
+    {
+        size_t length = packed.decode(index, block.data());
+        CHECK_EQ(length, packed.blockLength(index));
+        decoded.insert(decoded.end(), block.begin(), block.begin() + static_cast<ptrdiff_t>(length));
+    }
+    CHECK(decoded == values);
+
+    // Batches read through decoded blocks and resume where ++ and -- leave the cursors
+    MagicalContainer container;
+    container.setIndexCompression(true);
+    for (int value : values)
+    {
+        container.addElement(value);
+    }
+    MagicalContainer::DescendingIterator descending(container);
+    ++descending;
+    std::vector<int> batch(200);
+    CHECK_EQ(descending.next_batch(batch), 200);
+    CHECK(std::equal(batch.begin(), batch.end(), values.rbegin() + 1));
+    CHECK_EQ(*descending, -7);
+    --descending;
+    CHECK_EQ(*descending, batch.back());
+    MagicalContainer::SideCrossIterator cross(container);
+    std::vector<int> crossed(values.size());
+    CHECK_EQ(cross.next_batch(crossed), values.size());
+    CHECK(crossed == collect(MagicalContainer::SideCrossIterator(container)));
+}
+
+TEST_CASE("FixedMagicalContainer: checked iterators")
+{
+    FixedMagicalContainer<4> fixed;
+    for (int element : {9, 3, 7, 4})
+    {
+        fixed.addElement(element);
+    }
+    CHECK_EQ(fixed.size(), FixedMagicalContainer<4>::capacity());
+
+    // Every slot is taken, so reading past the end would leave the array
+    FixedMagicalContainer<4>::AscendingIterator ascending(fixed);
+    auto end = ascending.end();
+    CHECK_THROWS_AS(*end, std::runtime_error);
+    CHECK_THROWS_AS(++end, std::runtime_error);
+    auto last = ascending.begin();
+    for (int i = 0; i < 3; ++i)
+    {
+        ++last;
+    }
+    CHECK_EQ(*last, 9);
+    ++last;
+    CHECK(last == ascending.end());
+    CHECK_THROWS_AS(++last, std::runtime_error);
+
+    FixedMagicalContainer<4>::SideCrossIterator cross(fixed);
+    std::vector<int> crossed;
+    for (auto it = cross.begin(); it != cross.end(); ++it)
+    {
+        crossed.push_back(*it);
+    }
+    CHECK(crossed == std::vector<int>{3, 9, 4, 7});
+    auto crossEnd = cross.end();
+    CHECK_THROWS_AS(*crossEnd, std::runtime_error);
+
+    FixedMagicalContainer<4>::PrimeIterator primes(fixed);
+    auto prime = primes.begin();
+    CHECK_EQ(*prime, 3);
+    ++prime;
+    CHECK_EQ(*prime, 7);
+    ++prime;
+    CHECK(prime == primes.end());
+    CHECK_THROWS_AS(*prime, std::runtime_error);
+
+    // The order policies of MagicalContainer apply here too
+    std::vector<int> descending;
+    FixedMagicalContainer<4>::OrderedIterator<DescendingOrder> largestFirst(fixed);
+    for (auto it = largestFirst.begin(); it != largestFirst.end(); ++it)
+    {
+        descending.push_back(*it);
+    }
+    CHECK(descending == std::vector<int>{9, 7, 4, 3});
+
+    FixedMagicalContainer<4> empty;
+    FixedMagicalContainer<4>::OrderedIterator<AscendingOrder, AllElements, UncheckedIterators> unchecked(empty);
+    CHECK(unchecked.begin() == unchecked.end());
+    FixedMagicalContainer<4>::AscendingIterator emptyAscending(empty);
+    CHECK_THROWS_AS(*emptyAscending.begin(), std::runtime_error);
+}
+
+TEST_CASE("MagicalContainer: dense bitmap primes from an arena")
+{
+    static std::byte buffer[1 << 20];
+    std::pmr::monotonic_buffer_resource arena(buffer, sizeof(buffer), std::pmr::null_memory_resource());
+    ariel::pmr::MagicalContainer container(&arena);
+    for (int i = 0; i < 5000; ++i)
+    {
+        container.addElement(4000 + i);
+    }
+    container.setRepresentation(ariel::pmr::MagicalContainer::Representation::DenseBitmap);
+    std::vector<int> primes;
+    ariel::pmr::MagicalContainer::PrimeIterator primeIter(container);
+    for (auto it = primeIter.begin(); it != primeIter.end(); ++it)
+    {
+        primes.push_back(*it);
+    }
+    std::vector<int> expected;
+    for (int value = 4000; value < 9000; ++value)
+    {
+        if (MagicalContainer::PrimeIterator::isPrime(value))
+        {
+            expected.push_back(value);
+        }
+    }
+    CHECK(primes == expected);
+    CHECK_EQ(primes.front(), 4001);
+}
+
+TEST_CASE("MagicalContainer: a failed removal keeps page tokens")
+{
+    using Representation = MagicalContainer::Representation;
+    for (Representation representation : {Representation::Vector, Representation::RunLength, Representation::DenseBitmap,
+                                          Representation::Roaring})
+    {
+        MagicalContainer container;
+        for (int i = 1; i <= 30; ++i)
+        {
+            container.addElement(i);
+        }
+        container.setRepresentation(representation);
+        MagicalContainer::Page first = container.page(MagicalContainer::PageOrder::Ascending, MagicalContainer::PageToken(), 10);
+        CHECK_THROWS_AS(container.removeElement(100), std::runtime_error);
+        CHECK(container.isCurrent(first.next));
+        MagicalContainer::Page second = container.page(MagicalContainer::PageOrder::Ascending, first.next, 10);
+        CHECK_EQ(second.elements.front(), 11);
+        CHECK_EQ(container.size(), 30);
+
+        container.removeElement(30);
+        CHECK_FALSE(container.isCurrent(second.next));
+        CHECK_EQ(container.size(), 29);
+    }
+}
+
+TEST_CASE("MagicalContainer: copy into another allocator")
+{
+    CountingResource counting;
+    std::pmr::memory_resource *previous = std::pmr::set_default_resource(&counting);
+    static std::byte sourceBuffer[1 << 20];
+    static std::byte targetBuffer[1 << 20];
+    std::pmr::monotonic_buffer_resource sourceArena(sourceBuffer, sizeof(sourceBuffer), std::pmr::null_memory_resource());
+    std::pmr::monotonic_buffer_resource targetArena(targetBuffer, sizeof(targetBuffer), std::pmr::null_memory_resource());
+
+    ariel::pmr::MagicalContainer source(&sourceArena);
+    source.registerFilter<CountedMultiplesOfThree>();
+    for (int i = 1; i <= 300; ++i)
+    {
+        source.addElement(i * 5);
+    }
+    source.setRepresentation(ariel::pmr::MagicalContainer::Representation::Roaring);
+
+    // The filter matches and the Roaring chunks are nested buffers, and they come from the target as well
+    ariel::pmr::MagicalContainer copy(source, &targetArena);
+    CHECK_EQ(counting.allocations, 0);
+    std::pmr::set_default_resource(previous);
+
+    CHECK_EQ(copy.get_allocator().resource(), &targetArena);
+    CHECK_EQ(copy.size(), 300);
+    CHECK(copy.contains(1500));
+    std::vector<int> matches = collect(ariel::pmr::MagicalContainer::FilterIterator<CountedMultiplesOfThree>(copy));
+    CHECK_EQ(matches.size(), 100);
+    CHECK_EQ(matches.front(), 15);
+    source.removeElement(15);
+    CHECK(copy.contains(15));
+}
+
+TEST_CASE("FixedMagicalContainer: batches, stepping back and seeking")
+{
+    FixedMagicalContainer<8> fixed;
+    for (int element : {12, 5, 3, 17, 8, 11, 2})
+    {
+        fixed.addElement(element);
+    }
+
+    FixedMagicalContainer<8>::AscendingIterator ascending(fixed);
+    std::vector<int> batch(3);
+    CHECK_EQ(ascending.next_batch(batch), 3);
+    CHECK(batch == std::vector<int>{2, 3, 5});
+    CHECK_EQ(*ascending, 8);
+    std::vector<int> rest(10);
+    CHECK_EQ(ascending.next_batch(rest), 4);
+    CHECK(ascending == ascending.end());
+    CHECK_EQ(ascending.next_batch(rest), 0);
+
+    FixedMagicalContainer<8>::DescendingIterator descending(fixed);
+    CHECK_EQ(descending.next_batch(batch), 3);
+    CHECK(batch == std::vector<int>{17, 12, 11});
+    CHECK_EQ(*descending, 8);
+
+    FixedMagicalContainer<8>::SideCrossIterator cross(fixed);
+    ++cross;
+    std::vector<int> crossed(6);
+    CHECK_EQ(cross.next_batch(crossed), 6);
+    CHECK(crossed == std::vector<int>{17, 3, 12, 5, 11, 8});
+
+    // -- undoes ++ in every order, from end() as well
+    auto back = cross.end();
+    std::vector<int> reversed;
+    while (back != cross.begin())
+    {
+        --back;
+        reversed.push_back(*back);
+    }
+    CHECK(reversed == std::vector<int>{8, 11, 5, 12, 3, 17, 2});
+    CHECK_THROWS_AS(--back, std::runtime_error);
+
+    auto found = ascending.begin();
+    found.seek(9);
+    CHECK_EQ(*found, 11);
+    found.seek(4); // Never moves back
+    CHECK_EQ(*found, 11);
+    found.seek(100);
+    CHECK(found == ascending.end());
+
+    for (size_t position = 0; position <= fixed.size(); ++position)
+    {
+        auto jumped = cross.begin();
+        jumped.seekPosition(position);
+        auto stepped = cross.begin();
+        for (size_t i = 0; i < position; ++i)
+        {
+            ++stepped;
+        }
+        CHECK(jumped == stepped);
+        if (position < fixed.size())
+        {
+            CHECK_EQ(*jumped, *stepped);
+        }
+    }
+    CHECK_THROWS_AS(cross.begin().seekPosition(8), std::invalid_argument);
+
+    FixedMagicalContainer<8>::PrimeIterator primes(fixed);
+    auto prime = primes.begin();
+    prime.seekPosition(4);
+    CHECK_EQ(*prime, 17);
+    --prime;
+    CHECK_EQ(*prime, 11);
+}
+
+TEST_CASE("MagicalContainer: compressed indexes over the set representations")
+{
+    using Representation = MagicalContainer::Representation;
+    for (Representation representation : {Representation::DenseBitmap, Representation::Roaring})
+    {
+        MagicalContainer plain;
+        for (int i = 0; i < 3000; ++i)
+        {
+            plain.addElement(i * 7 % 3001 + 100);
+        }
+        plain.setRepresentation(representation);
+        MagicalContainer compressed = plain;
+        compressed.setIndexCompression(true);
+
+        CHECK(collect(MagicalContainer::AscendingIterator(compressed)) == collect(MagicalContainer::AscendingIterator(plain)));
+        CHECK(collect(MagicalContainer::SideCrossIterator(compressed)) == collect(MagicalContainer::SideCrossIterator(plain)));
+        CHECK(collect(MagicalContainer::PrimeIterator(compressed)) == collect(MagicalContainer::PrimeIterator(plain)));
+        CHECK(collect(MagicalContainer::FilterIterator<EvenElements>(compressed)) ==
+              collect(MagicalContainer::FilterIterator<EvenElements>(plain)));
+        CHECK_EQ(compressed.getRepresentation(), representation);
+
+        MagicalContainer::AscendingIterator found(compressed);
+        found.seek(2500);
+        CHECK_EQ(*found, 2500);
+    }
+}
+
+namespace
+{
+    // Walk an unchecked iterator every way and compare it with the checked one over the same container
+    template <typename Order, typename Filter = AllElements>
+    void checkFlatWalk(MagicalContainer &container)
+    {
+        using Checked = MagicalContainer::OrderedIterator<Order, Filter, CheckedIterators>;
+        using Unchecked = MagicalContainer::OrderedIterator<Order, Filter, UncheckedIterators>;
+        std::vector<int> expected = collect(Checked(container));
+        CHECK(collect(Unchecked(container)) == expected);
+
+        Unchecked batched(container);
+        std::vector<int> batches;
+        std::vector<int> batch(7);
+        for (size_t copied = batched.next_batch(batch); copied != 0; copied = batched.next_batch(batch))
+        {
+            batches.insert(batches.end(), batch.begin(), batch.begin() + static_cast<ptrdiff_t>(copied));
+        }
+        CHECK(batches == expected);
+
+        std::vector<int> reversed;
+        Unchecked walk(container);
+        for (auto it = walk.end(); it != walk.begin();)
+        {
+            --it;
+            reversed.push_back(*it);
+        }
+        CHECK(std::equal(reversed.rbegin(), reversed.rend(), expected.begin(), expected.end()));
+
+        for (size_t position = 0; position < expected.size(); position += 5)
+        {
+            auto jumped = walk.begin();
+            jumped.seekPosition(position);
+            CHECK_EQ(*jumped, expected[position]);
+            ++jumped;
+            if (position + 1 < expected.size())
+            {
+                CHECK_EQ(*jumped, expected[position + 1]);
+            }
+        }
+    }
+}
+
+TEST_CASE("MagicalContainer: unchecked iterators walk a flat array")
+{
+    using Representation = MagicalContainer::Representation;
+    for (Representation representation : {Representation::Vector, Representation::RunLength, Representation::DenseBitmap,
+                                          Representation::Roaring})
+    {
+        for (bool compressed : {false, true})
+        {
+            MagicalContainer container;
+            for (int i = 0; i < 600; ++i)
+            {
+                container.addElement(i * 13 % 601);
+                if (representation == Representation::Vector || representation == Representation::RunLength)
+                {
+                    container.addElement(i % 40); // Repeated values
+                }
+            }
+            container.setRepresentation(representation);
+            container.setIndexCompression(compressed && representation != Representation::RunLength &&
+                                          representation != Representation::Vector);
+            checkFlatWalk<AscendingOrder>(container);
+            checkFlatWalk<DescendingOrder>(container);
+            checkFlatWalk<SideCrossOrder>(container);
+            checkFlatWalk<FromTheBackOrder>(container);
+            checkFlatWalk<SideCrossOrder, PrimeElements>(container);
+            checkFlatWalk<AscendingOrder, EvenElements>(container);
+
+            MagicalContainer::OrderedIterator<AscendingOrder, AllElements, UncheckedIterators> found(container);
+            found.seek(300);
+            CHECK_EQ(*found, 300);
+        }
+    }
+
+    // A lazily sorted index is sorted completely the first time an unchecked iterator needs it
+    MagicalContainer lazy;
+    lazy.setLazySorting(true);
+    for (int i = 0; i < 500; ++i)
+    {
+        lazy.addElement(i * 7 % 500);
+    }
+    MagicalContainer::OrderedIterator<AscendingOrder, AllElements, CheckedIterators> partial(lazy);
+    CHECK_EQ(*partial, 0);
+    checkFlatWalk<SideCrossOrder>(lazy);
+    CHECK_EQ(*++partial, 1);
+}
@@ -0,0 +1,275 @@
+#ifndef DENSEBITMAP_HPP
+#define DENSEBITMAP_HPP
+
+#include <vector>
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+
+namespace ariel
+{
+    // Set of integers in the value range [base, base + span), one bit per value,
+    // with a popcount rank index for range counts and a lazily built prime mask
+    template <typename Allocator = std::allocator<uint64_t>>
+    class DenseBitmap
+    {
+    private:
+        static constexpr size_t BitsPerWord = 64;
+        static constexpr size_t WordsPerBlock = 8; // Granularity of the rank index
+
+        template <typename U>
+        using Rebind = typename std::allocator_traits<Allocator>::template rebind_alloc<U>;
+
+        int64_t base = 0;
+        size_t span = 0;
+        size_t count = 0;
+        std::vector<uint64_t, Rebind<uint64_t>> words;
+        mutable std::vector<size_t, Rebind<size_t>> blockRanks; // Set bits before each block, rebuilt after a change
+        mutable bool ranksValid = false;
+        mutable std::vector<uint64_t, Rebind<uint64_t>> primeWords; // Bit i is set when base + i is prime
+
+        size_t offsetOf(int value) const
+        {
+            return static_cast<size_t>(static_cast<int64_t>(value) - base);
+        }
+
+        // Number of set bits below offset
+        size_t rank(size_t offset) const
+        {
+            if (!ranksValid)
+            {
+                blockRanks.assign(words.size() / WordsPerBlock + 1, 0);
+                size_t total = 0;
+                for (size_t word = 0; word < words.size(); ++word)
+                {
+                    if (word % WordsPerBlock == 0)
+                    {
+                        blockRanks[word / WordsPerBlock] = total;
+                    }
+                    total += static_cast<size_t>(std::popcount(words[word]));
+                }
+                if (words.size() % WordsPerBlock == 0)
+                {
+                    blockRanks.back() = total;
+                }
+                ranksValid = true;
+            }
+
+            size_t lastWord = offset / BitsPerWord;
+            size_t result = blockRanks[lastWord / WordsPerBlock];
+            for (size_t word = lastWord - lastWord % WordsPerBlock; word < lastWord; ++word)
+            {
+                result += static_cast<size_t>(std::popcount(words[word]));
+            }
+            if (offset % BitsPerWord != 0)
+            {
+                uint64_t below = (uint64_t{1} << (offset % BitsPerWord)) - 1;
+                result += static_cast<size_t>(std::popcount(words[lastWord] & below));
+            }
+            return result;
+        }
+
+        // Sieve the primes of [base, base + span) into primeWords
+        void buildPrimeWords() const
+        {
+            primeWords.assign(words.size(), 0);
+            int64_t end = base + static_cast<int64_t>(span);
+            if (end <= 2)
+            {
+                return;
+            }
+            int64_t first = std::max<int64_t>(base, 2);
+            for (int64_t value = first; value < end; ++value)
+            {
+                size_t offset = static_cast<size_t>(value - base);
+                primeWords[offset / BitsPerWord] |= uint64_t{1} << (offset % BitsPerWord);
+            }
+
+            // Small primes up to sqrt(end) cross off their multiples inside the range. Their own sieve is a bit per value
+            // drawn from the allocator like every other buffer
+            auto limit = static_cast<size_t>(std::sqrt(static_cast<double>(end))) + 1;
+            std::vector<uint64_t, Rebind<uint64_t>> composite(limit / BitsPerWord + 1, 0, primeWords.get_allocator());
+            for (size_t factor = 2; factor <= limit; ++factor)
+            {
+                if (((composite[factor / BitsPerWord] >> (factor % BitsPerWord)) & 1U) != 0)
+                {
+                    continue;
+                }
+                for (size_t multiple = factor * factor; multiple <= limit; multiple += factor)
+                {
+                    composite[multiple / BitsPerWord] |= uint64_t{1} << (multiple % BitsPerWord);
+                }
+                auto step = static_cast<int64_t>(factor);
+                int64_t start = std::max(step * step, (first + step - 1) / step * step);
+                for (int64_t value = start; value < end; value += step)
+                {
+                    size_t offset = static_cast<size_t>(value - base);
+                    primeWords[offset / BitsPerWord] &= ~(uint64_t{1} << (offset % BitsPerWord));
+                }
+            }
+        }
+
+    public:
+        explicit DenseBitmap(const Allocator &alloc = Allocator()) : words(alloc), blockRanks(alloc), primeWords(alloc) {}
+
+        DenseBitmap(int64_t rangeBase, size_t rangeSpan, const Allocator &alloc = Allocator())
+            : base(rangeBase), span(rangeSpan), words((rangeSpan + BitsPerWord - 1) / BitsPerWord, 0, alloc), blockRanks(alloc), primeWords(alloc) {}
+
+        int64_t getBase() const
+        {
+            return base;
+        }
+
+        size_t getSpan() const
+        {
+            return span;
+        }
+
+        // Number of values in the set
+        size_t size() const
+        {
+            return count;
+        }
+
+        bool covers(int value) const
+        {
+            return value >= base && static_cast<int64_t>(value) - base < static_cast<int64_t>(span);
+        }
+
+        bool contains(int value) const
+        {
+            if (!covers(value))
+            {
+                return false;
+            }
+            size_t offset = offsetOf(value);
+            return ((words[offset / BitsPerWord] >> (offset % BitsPerWord)) & 1U) != 0;
+        }
+
+        // Add a covered value; returns false when it was already present
+        bool insert(int value)
+        {
+            size_t offset = offsetOf(value);
+            uint64_t bit = uint64_t{1} << (offset % BitsPerWord);
+            if ((words[offset / BitsPerWord] & bit) != 0)
+            {
+                return false;
+            }
+            words[offset / BitsPerWord] |= bit;
+            ++count;
+            ranksValid = false;
+            return true;
+        }
+
+        // Remove a value; returns false when it was not present
+        bool erase(int value)
+        {
+            if (!contains(value))
+            {
+                return false;
+            }
+            size_t offset = offsetOf(value);
+            words[offset / BitsPerWord] &= ~(uint64_t{1} << (offset % BitsPerWord));
+            --count;
+            ranksValid = false;
+            return true;
+        }
+
+        // Number of values in [low, high]
+        size_t countInRange(int low, int high) const
+        {
+            int64_t first = std::max<int64_t>(low, base);
+            int64_t last = std::min<int64_t>(high, base + static_cast<int64_t>(span) - 1);
+            if (first > last)
+            {
+                return 0;
+            }
+            return rank(static_cast<size_t>(last - base) + 1) - rank(static_cast<size_t>(first - base));
+        }
+
+        // Count, sum and extremes of a set of values; the extremes are meaningless while count is 0
+        struct Summary
+        {
+            size_t count = 0;
+            int64_t sum = 0;
+            int minimum = 0;
+            int maximum = 0;
+        };
+
+        // Summarize the values, or only the prime ones through the prime mask, without visiting them one by one.
+        // The offsets set in a word add up to the popcounts of the word under the six masks of the offsets whose bit k
+        // is set, weighted by 2^k, so a word costs seven popcounts however many values it holds
+        Summary summarize(bool primesOnly) const
+        {
+            static constexpr std::array<uint64_t, 6> OffsetBits = {0xAAAAAAAAAAAAAAAAULL, 0xCCCCCCCCCCCCCCCCULL, 0xF0F0F0F0F0F0F0F0ULL,
+                                                                   0xFF00FF00FF00FF00ULL, 0xFFFF0000FFFF0000ULL, 0xFFFFFFFF00000000ULL};
+            if (primesOnly && primeWords.size() != words.size())
+            {
+                buildPrimeWords();
+            }
+            Summary summary;
+            size_t firstWord = words.size();
+            size_t lastWord = 0;
+            for (size_t word = 0; word < words.size(); ++word)
+            {
+                uint64_t bits = primesOnly ? words[word] & primeWords[word] : words[word];
+                if (bits == 0)
+                {
+                    continue;
+                }
+                auto present = static_cast<size_t>(std::popcount(bits));
+                int64_t offsets = 0;
+                for (size_t bit = 0; bit < OffsetBits.size(); ++bit)
+                {
+                    offsets += static_cast<int64_t>(std::popcount(bits & OffsetBits[bit])) << bit;
+                }
+                summary.count += present;
+                summary.sum += (base + static_cast<int64_t>(word * BitsPerWord)) * static_cast<int64_t>(present) + offsets;
+                firstWord = std::min(firstWord, word);
+                lastWord = word;
+            }
+            if (summary.count != 0)
+            {
+                uint64_t first = primesOnly ? words[firstWord] & primeWords[firstWord] : words[firstWord];
+                uint64_t last = primesOnly ? words[lastWord] & primeWords[lastWord] : words[lastWord];
+                summary.minimum = static_cast<int>(base + static_cast<int64_t>(firstWord * BitsPerWord) + std::countr_zero(first));
+                summary.maximum = static_cast<int>(base + static_cast<int64_t>(lastWord * BitsPerWord + BitsPerWord - 1) - std::countl_zero(last));
+            }
+            return summary;
+        }
+
+        // Call visit on every value in ascending order, a word at a time
+        template <typename Visitor>
+        void forEach(Visitor visit) const
+        {
+            for (size_t word = 0; word < words.size(); ++word)
+            {
+                for (uint64_t bits = words[word]; bits != 0; bits &= bits - 1)
+                {
+                    visit(static_cast<int>(base + static_cast<int64_t>(word * BitsPerWord) + std::countr_zero(bits)));
+                }
+            }
+        }
+
+        // Call visit on every prime value in ascending order by ANDing with the prime mask
+        template <typename Visitor>
+        void forEachPrime(Visitor visit) const
+        {
+            if (primeWords.size() != words.size())
+            {
+                buildPrimeWords();
+            }
+            for (size_t word = 0; word < words.size(); ++word)
+            {
+                for (uint64_t bits = words[word] & primeWords[word]; bits != 0; bits &= bits - 1)
+                {
+                    visit(static_cast<int>(base + static_cast<int64_t>(word * BitsPerWord) + std::countr_zero(bits)));
+                }
+            }
+        }
+    };
+}
+#endif // DENSEBITMAP_HPP
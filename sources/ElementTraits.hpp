@@ -0,0 +1,196 @@
+#ifndef ELEMENTTRAITS_HPP
+#define ELEMENTTRAITS_HPP
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+namespace ariel
+{
+    // Per-type constants and kernels for the integral element types a MagicalContainer can hold.
+    // Everything is chosen from sizeof(T) at compile time, so no kernel branches on the type at run time
+    template <typename T>
+    struct ElementTraits
+    {
+        static_assert(std::is_integral_v<T> && !std::is_same_v<T, bool>, "MagicalContainer holds integral elements");
+
+        using Unsigned = std::make_unsigned_t<T>;
+
+        static constexpr size_t Bits = sizeof(T) * 8;
+
+        // Digit width of the LSD radix sort: one byte for narrow types, 11 bits (a 16 KiB histogram) otherwise
+        static constexpr size_t RadixBits = sizeof(T) <= 2 ? 8 : 11;
+        static constexpr size_t RadixPasses = (Bits + RadixBits - 1) / RadixBits;
+
+#if defined(__AVX512F__)
+        static constexpr size_t SimdBytes = 64;
+#elif defined(__AVX2__)
+        static constexpr size_t SimdBytes = 32;
+#else
+        static constexpr size_t SimdBytes = 16;
+#endif
+        // Elements per vector register, used as the block size of loops written for auto-vectorization
+        static constexpr size_t SimdLanes = SimdBytes / sizeof(T);
+
+        // Key whose unsigned order matches the order of the values; signed types get their sign bit flipped
+        static constexpr Unsigned orderedKey(T value)
+        {
+            if constexpr (std::is_signed_v<T>)
+            {
+                return static_cast<Unsigned>(static_cast<Unsigned>(value) ^ (Unsigned{1} << (Bits - 1)));
+            }
+            else
+            {
+                return value;
+            }
+        }
+
+        // Deterministic Miller-Rabin: bases 2, 7 and 61 cover every value below 2^32, and the seven bases of
+        // Jim Sinclair cover all 64-bit values. Products are reduced in Montgomery form, so no step divides
+        static bool isPrime(T num)
+        {
+            if (num < T{2})
+            {
+                return false;
+            }
+            auto value = static_cast<Word>(num);
+            for (Word small : {2U, 3U, 5U, 7U, 11U, 13U, 17U, 19U, 23U, 29U, 31U, 37U})
+            {
+                if (value % small == 0)
+                {
+                    return value == small;
+                }
+            }
+            if (value < 41 * 41)
+            {
+                return true;
+            }
+
+            Word odd = value - 1;
+            auto twos = static_cast<unsigned>(std::countr_zero(odd));
+            odd >>= twos;
+            Montgomery field(value);
+            if constexpr (sizeof(T) <= 4)
+            {
+                return !isWitness(field, 2, odd, twos) && !isWitness(field, 7, odd, twos) && !isWitness(field, 61, odd, twos);
+            }
+            else
+            {
+                for (Word base : {2U, 325U, 9375U, 28178U, 450775U, 9780504U, 1795265022U})
+                {
+                    if (isWitness(field, base, odd, twos))
+                    {
+                        return false;
+                    }
+                }
+                return true;
+            }
+        }
+
+        // Whether value could be prime: it is 2 to 7, or above and free of the factors 2, 3, 5 and 7.
+        // About 23% of large values pass, and the test is a few multiplications with no branch
+        static bool mayBePrime(T value)
+        {
+            auto word = static_cast<Word>(value);
+            bool coprime = (word % 2 != 0) & (word % 3 != 0) & (word % 5 != 0) & (word % 7 != 0);
+            return (value >= T{2}) & ((value <= T{7}) | coprime);
+        }
+
+        // Copy the primes among values[0, count) to out in order and return how many there are; out may be values.
+        // Stream compaction in two passes: every value is stored and the write position advances only past the ones
+        // mayBePrime keeps, so the filter never branches on the data, and Miller-Rabin runs on the compacted rest alone
+        static size_t compactPrimes(const T *values, size_t count, T *out)
+        {
+            size_t candidates = 0;
+            for (size_t index = 0; index < count; ++index)
+            {
+                T value = values[index];
+                out[candidates] = value;
+                candidates += static_cast<size_t>(mayBePrime(value));
+            }
+            size_t primes = 0;
+            for (size_t index = 0; index < candidates; ++index)
+            {
+                T value = out[index];
+                out[primes] = value;
+                primes += static_cast<size_t>(isPrime(value));
+            }
+            return primes;
+        }
+
+    private:
+        // Machine word wide enough for every value of T, and the double-width type of its products
+        using Word = std::conditional_t<sizeof(T) <= 4, uint32_t, uint64_t>;
+        using Wide = std::conditional_t<sizeof(T) <= 4, uint64_t, unsigned __int128>;
+        static constexpr size_t WordBits = sizeof(Word) * 8;
+
+        // Arithmetic modulo an odd modulus on residues scaled by R = 2^WordBits, where a product is reduced with two
+        // multiplications and a shift instead of a division (Montgomery, 1985)
+        struct Montgomery
+        {
+            Word modulus;
+            Word inverse; // modulus^-1 mod R
+            Word one;     // R mod modulus, the scaled 1
+
+            explicit Montgomery(Word odd) : modulus(odd), inverse(odd), one(static_cast<Word>(Word{0} - odd) % odd)
+            {
+                // An odd number is its own inverse mod 8, and each Newton step doubles the bits that are right
+                for (int step = 0; step < 5; ++step)
+                {
+                    inverse *= Word{2} - modulus * inverse;
+                }
+            }
+
+            Word scale(Word value) const
+            {
+                return static_cast<Word>((Wide{value} << WordBits) % modulus);
+            }
+
+            Word multiply(Word first, Word second) const
+            {
+                Wide product = Wide{first} * second;
+                // The low words of product and correction * modulus agree, so the difference of the high words is exact
+                Word correction = static_cast<Word>(product) * inverse;
+                auto high = static_cast<Word>(product >> WordBits);
+                auto subtracted = static_cast<Word>((Wide{correction} * modulus) >> WordBits);
+                return high >= subtracted ? high - subtracted : high - subtracted + modulus;
+            }
+        };
+
+        // Whether base proves the field's modulus = odd * 2^twos + 1 composite
+        static bool isWitness(const Montgomery &field, Word base, Word odd, unsigned twos)
+        {
+            base %= field.modulus;
+            if (base == 0)
+            {
+                return false;
+            }
+            Word minusOne = field.modulus - field.one;
+            Word square = field.scale(base);
+            Word power = field.one;
+            for (Word exponent = odd; exponent != 0; exponent >>= 1U)
+            {
+                if ((exponent & 1U) != 0)
+                {
+                    power = field.multiply(power, square);
+                }
+                square = field.multiply(square, square);
+            }
+            if (power == field.one || power == minusOne)
+            {
+                return false;
+            }
+            for (unsigned step = 1; step < twos; ++step)
+            {
+                power = field.multiply(power, power);
+                if (power == minusOne)
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+    };
+}
+#endif // ELEMENTTRAITS_HPP
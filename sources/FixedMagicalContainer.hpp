@@ -0,0 +1,339 @@
+#ifndef FIXEDMAGICALCONTAINER_HPP
+#define FIXEDMAGICALCONTAINER_HPP
+
+#include <array>
+#include <algorithm>
+#include <functional>
+#include <span>
+#include <stdexcept>
+#include <type_traits>
+
+#include "MagicalContainer.hpp"
+#include "SortingNetwork.hpp"
+
+namespace ariel
+{
+    // MagicalContainer with room for at most Capacity elements stored inline; it never allocates.
+    // The ascending and prime orders are kept in inline arrays, re-sorted by a sorting network after a change.
+    // Unlike MagicalContainer, its iterators read the current order, so a change invalidates them
+    template <size_t Capacity>
+    class FixedMagicalContainer
+    {
+    private:
+        std::array<int, Capacity> elements{};
+        size_t count = 0;
+        mutable std::array<int, Capacity> sorted{}; // Elements in ascending order, valid while sortedValid
+        mutable std::array<int, Capacity> primes{}; // The prime elements in ascending order
+        mutable size_t primeCount = 0;
+        mutable bool sortedValid = true;
+
+        void sortElements() const
+        {
+            if (sortedValid)
+            {
+                return;
+            }
+            std::copy(elements.begin(), elements.begin() + static_cast<ptrdiff_t>(count), sorted.begin());
+            networkSort(sorted.data(), count, std::less<int>());
+            primeCount = static_cast<size_t>(std::copy_if(sorted.begin(), sorted.begin() + static_cast<ptrdiff_t>(count), primes.begin(),
+                                                          MagicalContainer::PrimeIterator::isPrime) -
+                                             primes.begin());
+            sortedValid = true;
+        }
+
+        const std::array<int, Capacity> &ascending() const
+        {
+            sortElements();
+            return sorted;
+        }
+
+        const std::array<int, Capacity> &primeElements() const
+        {
+            sortElements();
+            return primes;
+        }
+
+        size_t primeSize() const
+        {
+            sortElements();
+            return primeCount;
+        }
+
+    public:
+        static constexpr size_t capacity()
+        {
+            return Capacity;
+        }
+
+        // Add an element to the container; throws once all Capacity slots are taken
+        void addElement(int element)
+        {
+            if (count == Capacity)
+            {
+                throw std::length_error("The fixed container is full");
+            }
+            elements[count++] = element;
+            sortedValid = false;
+        }
+
+        // Remove every occurrence of an element from the container
+        void removeElement(int element)
+        {
+            auto last = elements.begin() + static_cast<ptrdiff_t>(count);
+            auto kept = std::remove(elements.begin(), last, element);
+            if (kept == last)
+            {
+                throw std::runtime_error("The specified element was not found in the container");
+            }
+            count = static_cast<size_t>(kept - elements.begin());
+            sortedValid = false;
+        }
+
+        bool contains(int element) const
+        {
+            return std::find(elements.begin(), elements.begin() + static_cast<ptrdiff_t>(count), element) != elements.begin() + static_cast<ptrdiff_t>(count);
+        }
+
+        // Get the size of the container
+        size_t size() const
+        {
+            return count;
+        }
+
+        // Iterator over the elements accepted by Filter in the order given by Order, with the policies of
+        // MagicalContainer::OrderedIterator (see IteratorPolicies.hpp). It walks the sorted array, or the array of primes,
+        // from both ends. Checking selects whether misuse throws; by default it does unless NDEBUG is defined
+        template <typename Order, typename Filter = AllElements, typename Checking = DefaultIteratorChecking>
+        class OrderedIterator
+        {
+            static_assert(std::is_same_v<Filter, AllElements> || std::is_same_v<Filter, PrimeElements>,
+                          "A fixed container keeps only all of its elements and its primes in order");
+
+        private:
+            const FixedMagicalContainer *container; // The container iterated over
+            size_t front = 0;                        // Slot of the next element taken from the start
+            size_t back = 0;                         // Slot of the next element taken from the end
+            size_t position = 0;                     // Current index in the order
+
+            const std::array<int, Capacity> &sequence() const
+            {
+                if constexpr (std::is_same_v<Filter, PrimeElements>)
+                {
+                    return container->primeElements();
+                }
+                else
+                {
+                    return container->ascending();
+                }
+            }
+
+            size_t length() const
+            {
+                if constexpr (std::is_same_v<Filter, PrimeElements>)
+                {
+                    return container->primeSize();
+                }
+                else
+                {
+                    return container->size();
+                }
+            }
+
+            void checkSameContainer(const OrderedIterator &other) const
+            {
+                if constexpr (Checking::Enabled)
+                {
+                    if (container != other.container)
+                    {
+                        throw std::runtime_error("Iterators are pointing at different containers");
+                    }
+                }
+            }
+
+            void checkNotAtEnd() const
+            {
+                if constexpr (Checking::Enabled)
+                {
+                    if (position >= length())
+                    {
+                        throw std::runtime_error("The iterator is at the end of the container");
+                    }
+                }
+            }
+
+            // Place both cursors where target steps of ++ from begin() leave them
+            void place(size_t target)
+            {
+                size_t fronts = 0;
+                if constexpr (requires { Order::frontMoves(target); })
+                {
+                    fronts = Order::frontMoves(target + 1);
+                }
+                else
+                {
+                    for (size_t step = 0; step < target; ++step)
+                    {
+                        fronts += static_cast<size_t>(Order::takesFront(step));
+                    }
+                }
+                position = target;
+                front = fronts;
+                back = (length() == 0 ? 0 : length() - 1) - (target - fronts);
+            }
+
+        public:
+            OrderedIterator(const FixedMagicalContainer &cont) : container(&cont), back(length() == 0 ? 0 : length() - 1) {}
+
+            OrderedIterator(const OrderedIterator &other) = default;
+
+            ~OrderedIterator() = default;
+
+            OrderedIterator &operator=(const OrderedIterator &other)
+            {
+                checkSameContainer(other);
+                container = other.container;
+                front = other.front;
+                back = other.back;
+                position = other.position;
+                return *this;
+            }
+
+            bool operator==(const OrderedIterator &other) const
+            {
+                checkSameContainer(other);
+                return container == other.container && position == other.position;
+            }
+
+            bool operator!=(const OrderedIterator &other) const
+            {
+                return !(*this == other);
+            }
+
+            bool operator>(const OrderedIterator &other) const
+            {
+                checkSameContainer(other);
+                return position > other.position;
+            }
+
+            bool operator<(const OrderedIterator &other) const
+            {
+                checkSameContainer(other);
+                return position < other.position;
+            }
+
+            int operator*() const
+            {
+                checkNotAtEnd();
+                return sequence()[Order::takesFront(position) ? front : back];
+            }
+
+            OrderedIterator &operator++()
+            {
+                checkNotAtEnd();
+                if (Order::takesFront(position))
+                {
+                    ++front;
+                }
+                else
+                {
+                    --back;
+                }
+                ++position;
+                return *this;
+            }
+
+            // Copy up to out.size() elements of the order into out and move past them; returns how many were copied,
+            // 0 at the end. The ascending and descending orders copy a slice of the inline array
+            size_t next_batch(std::span<int> out)
+            {
+                size_t count = std::min(out.size(), length() - std::min(position, length()));
+                auto values = sequence().begin();
+                if constexpr (std::is_same_v<Order, AscendingOrder>)
+                {
+                    std::copy(values + static_cast<ptrdiff_t>(front), values + static_cast<ptrdiff_t>(front + count), out.begin());
+                    front += count;
+                }
+                else if constexpr (std::is_same_v<Order, DescendingOrder>)
+                {
+                    std::reverse_copy(values + static_cast<ptrdiff_t>(back + 1 - count), values + static_cast<ptrdiff_t>(back + 1), out.begin());
+                    back -= count;
+                }
+                else
+                {
+                    for (size_t copied = 0; copied < count; ++copied)
+                    {
+                        out[copied] = values[static_cast<ptrdiff_t>(Order::takesFront(position + copied) ? front++ : back--)];
+                    }
+                }
+                position += count;
+                return count;
+            }
+
+            // Step back to the previous element of the order, undoing the cursor move of the matching ++
+            OrderedIterator &operator--()
+            {
+                if constexpr (Checking::Enabled)
+                {
+                    if (position == 0)
+                    {
+                        throw std::runtime_error("The iterator is at the beginning of the container");
+                    }
+                }
+                --position;
+                if (Order::takesFront(position))
+                {
+                    --front;
+                }
+                else
+                {
+                    ++back;
+                }
+                return *this;
+            }
+
+            // Move forward to the first element not less than value, or to end() when there is none, by a binary search
+            // of the rest of the sorted array. Only ascending iterators can seek by value
+            OrderedIterator &seek(int value)
+            {
+                static_assert(std::is_same_v<Order, AscendingOrder>, "Seeking by value needs the ascending order; use seekPosition");
+                if (position < length())
+                {
+                    auto values = sequence().begin();
+                    auto found = std::lower_bound(values + static_cast<ptrdiff_t>(front), values + static_cast<ptrdiff_t>(length()), value);
+                    front = static_cast<size_t>(found - values);
+                    position = front;
+                }
+                return *this;
+            }
+
+            // Jump to a position of the order, forward or back. Throws when position is past end()
+            OrderedIterator &seekPosition(size_t target)
+            {
+                if (target > length())
+                {
+                    throw std::invalid_argument("The position is past the end of the iterator");
+                }
+                place(target);
+                return *this;
+            }
+
+            OrderedIterator begin() const
+            {
+                return OrderedIterator(*container);
+            }
+
+            OrderedIterator end() const
+            {
+                OrderedIterator iter(*container);
+                iter.place(iter.length());
+                return iter;
+            }
+        };
+
+        using AscendingIterator = OrderedIterator<AscendingOrder>;
+        using DescendingIterator = OrderedIterator<DescendingOrder>;
+        using SideCrossIterator = OrderedIterator<SideCrossOrder>;
+        using PrimeIterator = OrderedIterator<AscendingOrder, PrimeElements>;
+    };
+}
+#endif // FIXEDMAGICALCONTAINER_HPP
@@ -0,0 +1,115 @@
+#ifndef ITERATORPOLICIES_HPP
+#define ITERATORPOLICIES_HPP
+
+#include <cstddef>
+#include <type_traits>
+
+#include "ElementTraits.hpp"
+
+namespace ariel
+{
+    // Order policies of MagicalContainer::OrderedIterator. An order walks the sorted elements by taking each next
+    // element from the front or the back of the part not yet visited; takesFront(position) picks the end.
+    // Any class with such a constexpr static function is an order. It may also give frontMoves(length), the number of
+    // front takes among the first length - 1 positions, which lets -- step back from end() without counting them
+
+    // Smallest to largest
+    struct AscendingOrder
+    {
+        static constexpr bool takesFront(size_t)
+        {
+            return true;
+        }
+
+        static constexpr size_t frontMoves(size_t length)
+        {
+            return length == 0 ? 0 : length - 1;
+        }
+    };
+
+    // Largest to smallest
+    struct DescendingOrder
+    {
+        static constexpr bool takesFront(size_t)
+        {
+            return false;
+        }
+
+        static constexpr size_t frontMoves(size_t)
+        {
+            return 0;
+        }
+    };
+
+    // Alternately the smallest and the largest remaining element
+    struct SideCrossOrder
+    {
+        static constexpr bool takesFront(size_t position)
+        {
+            return position % 2 == 0;
+        }
+
+        static constexpr size_t frontMoves(size_t length)
+        {
+            return length / 2;
+        }
+    };
+
+    // Filter policies of MagicalContainer::OrderedIterator: default-constructible, stateless predicates on an element.
+    // Any such callable is a filter; its index is built with the predicate inlined and cached per filter type
+
+    struct AllElements
+    {
+        template <typename T>
+        constexpr bool operator()(T) const
+        {
+            return true;
+        }
+    };
+
+    struct PrimeElements
+    {
+        template <typename T>
+        bool operator()(T element) const
+        {
+            return ElementTraits<T>::isPrime(element);
+        }
+    };
+
+    // Checking policies of MagicalContainer::OrderedIterator. Checked iterators throw std::runtime_error on ++ or * at
+    // the end, on -- at the beginning and on assigning or comparing iterators of different containers; unchecked ones
+    // leave that to the caller and walk the index expanded into one array, so ++ is a pointer step and * a load
+
+    struct CheckedIterators
+    {
+        static constexpr bool Enabled = true;
+    };
+
+    struct UncheckedIterators
+    {
+        static constexpr bool Enabled = false;
+    };
+
+// Default checking policy: on unless NDEBUG is defined, so debug builds and `make test` keep the checks
+#ifndef MAGICAL_CHECKED_ITERATORS
+#ifdef NDEBUG
+#define MAGICAL_CHECKED_ITERATORS 0
+#else
+#define MAGICAL_CHECKED_ITERATORS 1
+#endif
+#endif
+
+    using DefaultIteratorChecking = std::conditional_t<MAGICAL_CHECKED_ITERATORS != 0, CheckedIterators, UncheckedIterators>;
+
+    // Filter made from a constexpr function given as a template argument, as in FilterIterator<FunctionFilter<isEven>>
+    template <auto Function>
+    struct FunctionFilter
+    {
+        template <typename T>
+        constexpr bool operator()(T element) const
+        {
+            return Function(element);
+        }
+    };
+}
+#endif // ITERATORPOLICIES_HPP
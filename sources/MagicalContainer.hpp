@@ -2,380 +2,2821 @@
 #define MAGICALCONTAINER_HPP
 
 #include <vector>
+#include <array>
 #include <algorithm>
+#include <bit>
+#include <cassert>
 #include <cmath>
+#include <cstdint>
 #include <iostream>
 #include <functional>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <memory_resource>
+#include <span>
+#include <stdexcept>
+#include <type_traits>
+
+#include "DenseBitmap.hpp"
+#include "ElementTraits.hpp"
+#include "IteratorPolicies.hpp"
+#include "MinMaxHeap.hpp"
+#include "PackedSortedIndex.hpp"
+#include "RoaringSet.hpp"
+#include "SortingNetwork.hpp"
 
 using namespace std;
 namespace ariel
 {
-    class MagicalContainer
+    // Container of integral elements of type T. Every allocation of the container and of its indexes goes through
+    // Allocator, rebound to the stored type. The dense bitmap and roaring representations and index compression
+    // store 32-bit signed values, so they are only available when T is int
+    template <typename T = int, typename Allocator = std::allocator<T>>
+    class BasicMagicalContainer
     {
-    private:
-        std::vector<int> elements;
-
     public:
-        // Add an element to the container
-        void addElement(int element)
+        using value_type = T;
+        using allocator_type = Allocator;
+
+        // How removeElement closes the gap left by a removed element
+        enum class RemovalMode
         {
-            elements.push_back(element);
-        }
+            Ordered,   // Erase and shift the tail, preserving insertion order
+            SwapAndPop, // Move the last element into the gap, O(1) per removed element
+            Tombstone   // Mark the slot dead and compact once the dead fraction passes a threshold
+        };
 
-        // Remove an element from the container
-        void removeElement(int element)
+        // Internal layout used to store the elements. The set layouts only shrink the stored elements: iterators walk a
+        // sorted index rebuilt after each change, which copies a set into one 8-byte run per element, or into
+        // delta-packed blocks with index compression on
+        enum class Representation
         {
-            auto iter = std::find(elements.begin(), elements.end(), element);
-            if (iter == elements.end())
-            {
-                throw std::runtime_error("The specified element was not found in the container");
-            }
-            elements.erase(std::remove(elements.begin(), elements.end(), element), elements.end());
-        }
+            Vector,     // One slot per element, in insertion order
+            RunLength,  // One sorted (value, count) run per distinct value
+            DenseBitmap, // One bit per value of a small range holding distinct values
+            Roaring      // Distinct values split by their high 16 bits into array, bitmap or run chunks
+        };
 
-        // Get the size of the container
-        size_t size() const
+        // Index rebuilds that reused a pooled index and rebuilds that had to allocate a new one
+        struct IndexPoolStats
         {
-            return elements.size();
-        }
+            size_t hits = 0;
+            size_t misses = 0;
+        };
 
-        // Get the underlying vector of elements
-        std::vector<int> &getElemnets()
+        // How many occurrences of a value removeElement takes out
+        enum class RemovalScope
         {
-            return elements;
-        }
+            All, // Every occurrence of the value
+            One  // Only the first occurrence found
+        };
 
-        // Set the elements of the container from a given vector
-        void Setelements(std::vector<int> &container)
+        // Orders page() can read in
+        enum class PageOrder
         {
-            elements = container;
-        }
+            Ascending,
+            SideCross,
+            Prime
+        };
 
-        class AscendingIterator
+        // Statistics aggregate() computes
+        enum class Aggregate
         {
-        private:
-            MagicalContainer &container;       // Reference to the MagicalContainer
-            std::vector<int *> sortedElements; // Vector of pointers to elements
-            size_t currentIndex;               // Current index in the sortedElements vector
+            Sum,   // Total of the elements in 64 bits, wrapping around past the range of Total
+            Count, // Number of elements
+            Min,   // Smallest element
+            Max    // Largest element
+        };
 
-        public:
-            AscendingIterator(MagicalContainer &cont) : container(cont), currentIndex(0)
-            {
-                // Reserve space for sortedElements vector
-                sortedElements.reserve(container.size());
+        // Result of aggregate(): a 64-bit integer of the signedness of T
+        using Total = std::conditional_t<std::is_signed_v<T>, int64_t, uint64_t>;
 
-                // Populate sortedElements vector with pointers to elements
-                for (int &element : container.getElemnets())
-                {
-                    sortedElements.push_back(&element);
-                }
+        // Where the next page starts: a position in the order and the generation of the container it belongs to.
+        // The default token starts at the beginning of any generation
+        struct PageToken
+        {
+            size_t generation = 0;
+            size_t position = 0;
+        };
 
-                // Sort the sortedElements vector in ascending order
-                std::sort(sortedElements.begin(), sortedElements.end(), [](const int *num1, const int *num2)
-                          { return *num1 < *num2; });
-            }
+        // Elements of one page and the token of the page after it
+        struct Page
+        {
+            std::vector<T> elements;
+            PageToken next;
+            bool last = false; // No elements follow this page
+        };
 
-            // Copy constructor
-            AscendingIterator(const AscendingIterator &other) : container(other.container), sortedElements(other.sortedElements), currentIndex(other.currentIndex) {}
+    private:
+        static constexpr size_t SlotsPerWord = 64;
+        static constexpr size_t DenseMinSize = 1024;            // Smaller containers stay vectors
+        static constexpr size_t DenseMaxSpan = size_t{1} << 22; // Widest value range a bitmap may cover
+        static constexpr size_t DenseBitsPerElement = 32;       // Use a bitmap only while it is no larger than the vector
+        static constexpr size_t IndexPoolSize = 4;              // Sorted indexes kept for reuse by each container
+        static constexpr size_t RadixSortMin = 256;             // Smaller gathers are sorted by comparison
+        static constexpr bool SetRepresentations = std::is_same_v<T, int>;
 
-            // Destructor
-            ~AscendingIterator() {}
+        using Traits = ElementTraits<T>;
+
+        template <typename U>
+        using Rebind = typename std::allocator_traits<Allocator>::template rebind_alloc<U>;
+
+        // A value together with the number of copies of it in the container. The count is 32 bits, so a run of int is
+        // 8 bytes; a value repeated more often than that makes the operation counting it throw std::length_error
+        struct Run
+        {
+            T value;
+            uint32_t count;
+        };
+
+        using RunVector = std::vector<Run, Rebind<Run>>;
+
+        // Position in a SortedIndex: a run and the copies of it already passed,
+        // or a block, a slot in it and the value decoded there when the index is packed
+        struct IndexCursor
+        {
+            size_t block = 0;
+            size_t offset = 0;
+            T value = 0;
+        };
+
+        // Elements in ascending order, shared by every iterator built while the container is unchanged.
+        // They are kept as runs of equal values, or as packed blocks when index compression is on.
+        // A lazily built index has one run per element; the elements not yet reached wait in a min-max heap, and each
+        // end of the runs is filled from it as cursors reach them
+        struct SortedIndex
+        {
+            mutable RunVector runs;
+            ariel::PackedSortedIndex<Allocator> packed;
+            bool isPacked = false;
+            size_t length = 0; // Number of elements in the index
+            mutable std::vector<T, Allocator> pending; // Min-max heap of the elements of runs[filledFront, filledBack)
+            mutable size_t filledFront = 0;
+            mutable size_t filledBack = 0;
+            size_t eagerAfter = 0; // Elements taken from the heap one at a time before the rest is sorted at once
+            mutable std::vector<size_t, Rebind<size_t>> starts; // See runStarts
+            mutable std::vector<T, Allocator> values;           // See flatten
 
-            // Default move constructor
-            AscendingIterator(AscendingIterator &&other) noexcept;
+            explicit SortedIndex(const Allocator &alloc) : runs(alloc), packed(alloc), pending(alloc), starts(alloc), values(alloc) {}
 
-            // Default move assignment operator
-            AscendingIterator &operator=(AscendingIterator &&other) noexcept;
+            // Empty the index for a rebuild, keeping its buffers
+            void clear()
+            {
+                runs.clear();
+                packed.clear();
+                isPacked = false;
+                length = 0;
+                pending.clear();
+                filledFront = 0;
+                filledBack = 0;
+                eagerAfter = 0;
+                starts.clear();
+                values.clear();
+            }
 
-            AscendingIterator &operator=(const AscendingIterator &other) noexcept
+            // Fill runs[block] from the heap if a cursor moving forward just reached the unfilled middle
+            void reachFromFront(size_t block) const
             {
-                if (this != &other)
+                if (!pending.empty() && block == filledFront)
                 {
-                    container = other.container;
-                    sortedElements = other.sortedElements;
-                    currentIndex = other.currentIndex;
+                    fill(true);
                 }
-                return *this;
             }
 
-            bool operator==(const AscendingIterator &other) const
+            // Fill runs[block] from the heap if a cursor moving backward just reached the unfilled middle
+            void reachFromBack(size_t block) const
             {
-                return &container == &other.container && currentIndex == other.currentIndex;
+                if (!pending.empty() && block + 1 == filledBack)
+                {
+                    fill(false);
+                }
             }
 
-            bool operator!=(const AscendingIterator &other) const
+            // Take the smallest or largest pending element, or sort the whole middle once more than eagerAfter
+            // elements have been taken
+            void fill(bool smallest) const
             {
-                return !(*this == other);
+                if (length - pending.size() > eagerAfter)
+                {
+                    complete();
+                    return;
+                }
+                if (smallest)
+                {
+                    popMinMaxHeapMin(pending.data(), pending.size(), std::less<T>());
+                    runs[filledFront++].value = pending.back();
+                }
+                else
+                {
+                    popMinMaxHeapMax(pending.data(), pending.size(), std::less<T>());
+                    runs[--filledBack].value = pending.back();
+                }
+                pending.pop_back();
             }
 
-            bool operator>(const AscendingIterator &other) const
+            // Sort every pending element into the middle of runs
+            void complete() const
             {
-                return currentIndex > other.currentIndex;
+                if (pending.empty())
+                {
+                    return;
+                }
+                std::sort(pending.begin(), pending.end());
+                for (T value : pending)
+                {
+                    runs[filledFront++].value = value;
+                }
+                pending.clear();
             }
 
-            bool operator<(const AscendingIterator &other) const
+            IndexCursor first() const
             {
-                return currentIndex < other.currentIndex;
+                reachFromFront(0);
+                IndexCursor cursor;
+                if (isPacked && packed.blockCount() != 0)
+                {
+                    cursor.value = static_cast<T>(packed.firstOf(0));
+                }
+                return cursor;
             }
 
-            int operator*() const
+            IndexCursor last() const
             {
-                return *sortedElements[currentIndex];
+                IndexCursor cursor;
+                if (isPacked && packed.blockCount() != 0)
+                {
+                    cursor.block = packed.blockCount() - 1;
+                    cursor.offset = packed.blockLength(cursor.block) - 1;
+                    cursor.value = static_cast<T>(packed.lastOf(cursor.block));
+                }
+                else if (!isPacked && !runs.empty())
+                {
+                    cursor.block = runs.size() - 1;
+                    reachFromBack(cursor.block);
+                    cursor.offset = runs.back().count - 1;
+                }
+                return cursor;
             }
 
-            AscendingIterator &operator++()
+            T value(const IndexCursor &cursor) const
             {
-                ++currentIndex;
-                return *this;
+                return isPacked ? cursor.value : runs[cursor.block].value;
             }
 
-            AscendingIterator begin()
+            // Every element of the index in one array, for iterators that walk it with plain pointers. Built by the first
+            // such iterator after a rebuild, which sorts a lazy index completely and expands the runs or packed blocks
+            const T *flatten() const
             {
-                AscendingIterator iter(container);
-                return iter;
+                if (values.size() != length)
+                {
+                    complete();
+                    values.clear();
+                    values.reserve(length);
+                    if (isPacked)
+                    {
+                        std::array<int, ariel::PackedSortedIndex<Allocator>::BlockSize> decoded;
+                        for (size_t block = 0; block < packed.blockCount(); ++block)
+                        {
+                            size_t count = packed.decode(block, decoded.data());
+                            values.insert(values.end(), decoded.begin(), decoded.begin() + static_cast<ptrdiff_t>(count));
+                        }
+                    }
+                    else
+                    {
+                        for (const Run &run : runs)
+                        {
+                            values.insert(values.end(), run.count, run.value);
+                        }
+                    }
+                }
+                return values.data();
             }
 
-            AscendingIterator end() const
+            // Rank of the first copy of every run, built by the first rank lookup after a rebuild
+            const std::vector<size_t, Rebind<size_t>> &runStarts() const
             {
-                AscendingIterator iter(container);
-                iter.currentIndex = sortedElements.size();
-                return iter;
+                if (starts.size() != runs.size())
+                {
+                    starts.clear();
+                    size_t rank = 0;
+                    for (const Run &run : runs)
+                    {
+                        starts.push_back(rank);
+                        rank += run.count;
+                    }
+                }
+                return starts;
             }
-        };
 
-        class SideCrossIterator
-        {
-        private:
-            MagicalContainer &container; // Reference to the MagicalContainer
-            std::vector<int *> cross;    // Vector of pointers to elements
-            size_t currIndex = 0;        // Current index in the cross vector
-
-        public:
-            // Constructor
-            SideCrossIterator(MagicalContainer &container) : container(container)
+            // Rank of the element at cursor
+            size_t rankOf(const IndexCursor &cursor) const
             {
-                size_t thebegin = 0;
-                size_t theend = container.getElemnets().size() - 1;
-                cross.reserve(container.size());
-                std::vector<int> sortedElements = container.getElemnets();
-                std::sort(sortedElements.begin(), sortedElements.end());
+                if (isPacked)
+                {
+                    return cursor.block * ariel::PackedSortedIndex<Allocator>::BlockSize + cursor.offset;
+                }
+                return runStarts()[cursor.block] + cursor.offset;
+            }
 
-                int num = 0;
-                while (thebegin <= theend)
+            // Move cursor forward to the first element not less than value and return its rank, or return length and
+            // leave cursor alone when there is none. Runs are searched by galloping from cursor, packed blocks through their headers
+            size_t lowerBound(T value, IndexCursor &cursor) const
+            {
+                complete();
+                if (isPacked)
                 {
-                    if (thebegin == theend)
+                    size_t block = std::max(cursor.block, packed.findBlock(static_cast<int>(value)));
+                    if (block == packed.blockCount())
                     {
-                        cross.push_back(&(container.getElemnets()[thebegin]));
-                        break;
+                        return length;
                     }
-                    if (num % 2 == 0)
+                    IndexCursor found = block == cursor.block ? cursor : IndexCursor{block, 0, static_cast<T>(packed.firstOf(block))};
+                    while (found.value < value)
                     {
-                        cross.push_back(&(container.getElemnets()[thebegin]));
-                        thebegin++;
+                        ++found.offset;
+                        found.value = static_cast<T>(static_cast<uint32_t>(found.value) + packed.delta(block, found.offset));
                     }
-                    else
+                    cursor = found;
+                    return rankOf(cursor);
+                }
+                if (runs[cursor.block].value >= value)
+                {
+                    return rankOf(cursor);
+                }
+                size_t low = cursor.block;
+                size_t high = cursor.block + 1;
+                for (size_t step = 2; high < runs.size() && runs[high].value < value; step *= 2)
+                {
+                    low = high;
+                    high = std::min(high + step, runs.size());
+                }
+                auto found = std::lower_bound(runs.begin() + static_cast<ptrdiff_t>(low + 1), runs.begin() + static_cast<ptrdiff_t>(high), value, runBefore);
+                if (found == runs.end())
+                {
+                    return length;
+                }
+                cursor.block = static_cast<size_t>(found - runs.begin());
+                cursor.offset = 0;
+                return rankOf(cursor);
+            }
+
+            // Cursor at the element of the given rank, found by binary search over the run starts or by decoding one packed block
+            IndexCursor seek(size_t rank) const
+            {
+                complete();
+                IndexCursor cursor;
+                if (isPacked)
+                {
+                    // Every block but the last is full
+                    cursor.block = rank / ariel::PackedSortedIndex<Allocator>::BlockSize;
+                    cursor.value = static_cast<T>(packed.firstOf(cursor.block));
+                    for (size_t slot = 1; slot <= rank % ariel::PackedSortedIndex<Allocator>::BlockSize; ++slot)
                     {
-                        cross.push_back(&(container.getElemnets()[theend]));
-                        theend--;
+                        cursor.value = static_cast<T>(static_cast<uint32_t>(cursor.value) + packed.delta(cursor.block, slot));
+                        cursor.offset = slot;
                     }
-                    num++;
+                    return cursor;
                 }
-
-                container.Setelements(sortedElements);
+                const auto &firstRanks = runStarts();
+                cursor.block = static_cast<size_t>(std::upper_bound(firstRanks.begin(), firstRanks.end(), rank) - firstRanks.begin()) - 1;
+                cursor.offset = rank - firstRanks[cursor.block];
+                return cursor;
             }
 
-            // Copy constructor
-            SideCrossIterator(const SideCrossIterator &other) : container(other.container), currIndex(other.currIndex), cross(other.cross) {}
+            // Step to the following element; callers stop at the end of the index
+            void next(IndexCursor &cursor) const
+            {
+                if (!isPacked)
+                {
+                    // Runs are expanded virtually: move to the next run once every copy has been passed
+                    if (++cursor.offset == runs[cursor.block].count)
+                    {
+                        ++cursor.block;
+                        cursor.offset = 0;
+                        reachFromFront(cursor.block);
+                    }
+                }
+                else if (++cursor.offset < packed.blockLength(cursor.block))
+                {
+                    cursor.value = static_cast<T>(static_cast<uint32_t>(cursor.value) + packed.delta(cursor.block, cursor.offset));
+                }
+                else if (++cursor.block < packed.blockCount())
+                {
+                    cursor.offset = 0;
+                    cursor.value = static_cast<T>(packed.firstOf(cursor.block));
+                }
+            }
 
-            // copy assignment operator
-            SideCrossIterator &operator=(const SideCrossIterator &other)
+            // Step to the preceding element; callers never step back from the first one
+            void prev(IndexCursor &cursor) const
             {
-                if (this != &other)
+                if (cursor.offset != 0)
                 {
-                    container = other.container;
-                    currIndex = other.currIndex;
-                    cross = other.cross;
+                    if (isPacked)
+                    {
+                        cursor.value = static_cast<T>(static_cast<uint32_t>(cursor.value) - packed.delta(cursor.block, cursor.offset));
+                    }
+                    --cursor.offset;
+                    return;
+                }
+                --cursor.block;
+                if (isPacked)
+                {
+                    cursor.offset = packed.blockLength(cursor.block) - 1;
+                    cursor.value = static_cast<T>(packed.lastOf(cursor.block));
+                }
+                else
+                {
+                    reachFromBack(cursor.block);
+                    cursor.offset = runs[cursor.block].count - 1;
                 }
-                return *this;
             }
+        };
 
-            // Destructor
-            ~SideCrossIterator() {}
+        std::vector<T, Allocator> elements;
+        RemovalMode removalMode = RemovalMode::Ordered;
+        Representation representation = Representation::Vector;
+        RunVector runs;      // Sorted by value while the representation is RunLength
+        size_t runTotal = 0; // Sum of the counts in runs
+        ariel::DenseBitmap<Allocator> dense;  // Holds the elements while the representation is DenseBitmap
+        ariel::RoaringSet<Allocator> roaring; // Holds the elements while the representation is Roaring
+        bool automaticRepresentation = true;
+        size_t mutations = 0;      // Number of addElement and removeElement calls so far
+        size_t nextDenseCheck = 0; // Mutation count at which a vector may next be turned into a bitmap
+        std::shared_ptr<const SortedIndex> ascendingIndex;
+        std::shared_ptr<const SortedIndex> primeIndex;
+        size_t ascendingVersion = 0;  // Mutation count when ascendingIndex was built
+        size_t primeVersion = 0;      // Mutation count when primeIndex was built
+        bool elementsExposed = false; // getElemnets handed out the vector, so it may change behind the cached indexes
+        bool heapOrdered = false;     // The vector is a min-max heap, kept so by addElement, popMin and popMax
+        mutable T minimum = 0;          // Smallest element while extremesKnown
+        mutable T maximum = 0;          // Largest element while extremesKnown
+        mutable bool extremesKnown = true; // Kept by addElement; cleared when an extreme is removed
+        bool indexCompression = false; // Keep the shared indexes as packed blocks instead of runs
+        bool lazySorting = false;      // Heapify rather than sort the elements for iterators over all of them
+        double lazySortFraction = 0.125; // Fraction of a lazy index read one value at a time before the rest is sorted
+        std::vector<std::shared_ptr<SortedIndex>, Rebind<std::shared_ptr<SortedIndex>>> indexPool; // Indexes whose buffers are refilled on a rebuild
+        IndexPoolStats poolStats;
+        mutable RunVector radixScratch; // Second buffer of the radix sort, kept between index rebuilds
+
+        // Cached index of the elements accepted by one user-defined filter type
+        struct FilterIndex
+        {
+            const void *filter; // Address of filterTag<Filter>, unique to the filter type
+            std::shared_ptr<const SortedIndex> index;
+            size_t version; // Mutation count when index was built
+        };
+
+        template <typename Filter>
+        static constexpr char filterTag = 0;
+
+        std::vector<FilterIndex, Rebind<FilterIndex>> filterIndexes;
+
+        // The elements accepted by a registered filter as sorted runs, updated by every addElement and removeElement
+        struct FilterMatches
+        {
+            const void *filter; // Address of filterTag<Filter>
+            bool (*accepts)(T); // The filter, called once per added or removed element
+            RunVector runs;
+        };
+
+        std::vector<FilterMatches, Rebind<FilterMatches>> filterMatches;
+        bool steadyState = false;                         // Report every allocation through allocationHook
+        std::function<void(const char *)> allocationHook; // Called with the allocating operation while steadyState is on
+        std::vector<uint64_t, Rebind<uint64_t>> deadSlots; // Bit i is set while elements[i] is a tombstone
+        size_t deadCount = 0;            // Number of tombstones in elements
+        double compactionThreshold = 0.25;
 
-            // move constructor
-            SideCrossIterator(SideCrossIterator &&other) noexcept;
+        bool isDead(size_t index) const
+        {
+            size_t word = index / SlotsPerWord;
+            return word < deadSlots.size() && ((deadSlots[word] >> (index % SlotsPerWord)) & 1U) != 0;
+        }
 
-            // move assignment operator
-            SideCrossIterator &operator=(SideCrossIterator &&other) noexcept
+        // Find the first live occurrence of element at or after index
+        size_t findLive(T element, size_t index) const
+        {
+            for (; index < elements.size(); ++index)
             {
-                if (this != &other)
+                if (elements[index] == element && !isDead(index))
                 {
-                    container = std::move(other.container);
-                    currIndex = other.currIndex;
+                    return index;
                 }
-                return *this;
-            }
-            bool operator>(const SideCrossIterator &other) const
-            {
-                return currIndex > other.currIndex;
             }
+            return elements.size();
+        }
 
-            bool operator<(const SideCrossIterator &other) const
+        // Mark occurrences of element starting at index as dead, compacting when too many slots are dead
+        void markDead(size_t index, T element, RemovalScope scope)
+        {
+            size_t reserved = deadSlots.capacity();
+            deadSlots.resize((elements.size() + SlotsPerWord - 1) / SlotsPerWord, 0);
+            if (deadSlots.capacity() != reserved)
             {
-                return currIndex < other.currIndex;
+                noteAllocation("removeElement");
             }
-
-            SideCrossIterator &operator++()
+            for (; index < elements.size(); index = findLive(element, index + 1))
             {
-                // Increment the index
-                currIndex++;
-                return *this;
+                deadSlots[index / SlotsPerWord] |= uint64_t{1} << (index % SlotsPerWord);
+                ++deadCount;
+                if (scope == RemovalScope::One)
+                {
+                    break;
+                }
             }
-
-            int operator*() const
+            if (static_cast<double>(deadCount) > compactionThreshold * static_cast<double>(elements.size()))
             {
-                return *cross[currIndex];
+                compact();
             }
+        }
 
-            bool operator==(const SideCrossIterator &other) const
+        // Call visit on every live element, skipping tombstones a word at a time
+        template <typename Visitor>
+        void forEachLive(Visitor visit) const
+        {
+            for (size_t base = 0; base < elements.size(); base += SlotsPerWord)
             {
-                return currIndex == other.currIndex;
+                size_t word = base / SlotsPerWord;
+                uint64_t live = word < deadSlots.size() ? ~deadSlots[word] : ~uint64_t{0};
+                size_t remaining = elements.size() - base;
+                if (remaining < SlotsPerWord)
+                {
+                    live &= (uint64_t{1} << remaining) - 1;
+                }
+                while (live != 0)
+                {
+                    visit(elements[base + static_cast<size_t>(std::countr_zero(live))]);
+                    live &= live - 1;
+                }
             }
+        }
 
-            bool operator!=(const SideCrossIterator &other) const
+        // Remove occurrences of element starting at index by swapping the last element into their slot
+        void swapAndPop(size_t index, T element, RemovalScope scope)
+        {
+            while (index < elements.size())
             {
-                return currIndex != other.currIndex;
+                if (elements[index] != element)
+                {
+                    ++index;
+                    continue;
+                }
+                elements[index] = elements.back();
+                elements.pop_back();
+                if (scope == RemovalScope::One)
+                {
+                    return;
+                }
             }
+        }
+
+        static bool runBefore(const Run &run, T value)
+        {
+            return run.value < value;
+        }
 
-            SideCrossIterator begin() const
+        // Count one more copy of the value of run
+        static void addCopy(Run &run)
+        {
+            if (run.count == std::numeric_limits<uint32_t>::max())
             {
-                return SideCrossIterator(container);
+                throw std::length_error("A value is repeated more times than a run can count");
             }
+            ++run.count;
+        }
 
-            SideCrossIterator end() const
+        // Number of elements in the sequence the runs expand to
+        static size_t expandedSize(const RunVector &sortedRuns)
+        {
+            size_t total = 0;
+            for (const Run &run : sortedRuns)
             {
-                SideCrossIterator iter(container);
-                iter.currIndex = cross.size();
-                return iter;
+                total += run.count;
             }
-        };
+            return total;
+        }
 
-        class PrimeIterator
+        // Sort runs by value with an LSD radix sort whose digit width and pass count come from ElementTraits<T>
+        void radixSort(RunVector &sortedRuns) const
         {
-        private:
-            MagicalContainer &container;     // Reference to the MagicalContainer
-            std::vector<int *> primeNumbers; // Vector of pointers to prime numbers in the container
-            size_t currentIndex;             // Current index in the primeNumbers vector
+            constexpr size_t Buckets = size_t{1} << Traits::RadixBits;
+            size_t reserved = radixScratch.capacity();
+            radixScratch.resize(sortedRuns.size());
+            if (radixScratch.capacity() != reserved)
+            {
+                noteAllocation("index rebuild");
+            }
 
-        public:
-            PrimeIterator(MagicalContainer &cont) : container(cont), currentIndex(0)
+            std::array<size_t, Buckets> offsets;
+            Run *from = sortedRuns.data();
+            Run *to = radixScratch.data();
+            size_t length = sortedRuns.size();
+            for (size_t pass = 0; pass < Traits::RadixPasses; ++pass)
             {
-                for (int &element : container.getElemnets())
+                size_t shift = pass * Traits::RadixBits;
+                auto digit = [shift](const Run &run)
                 {
-                    if (isPrime(element))
-                    {
-                        primeNumbers.push_back(&element); // Store pointer to prime number element
-                    }
+                    return static_cast<size_t>(Traits::orderedKey(run.value) >> shift) & (Buckets - 1);
+                };
+                offsets.fill(0);
+                for (size_t i = 0; i < length; ++i)
+                {
+                    ++offsets[digit(from[i])];
                 }
-
-                std::sort(primeNumbers.begin(), primeNumbers.end(), [](const int *num1, const int *num2)
-                          { return *num1 < *num2; });
+                // A pass where every value has the same digit would only copy
+                if (offsets[digit(from[0])] == length)
+                {
+                    continue;
+                }
+                size_t total = 0;
+                for (size_t &offset : offsets)
+                {
+                    size_t count = offset;
+                    offset = total;
+                    total += count;
+                }
+                for (size_t i = 0; i < length; ++i)
+                {
+                    to[offsets[digit(from[i])]++] = from[i];
+                }
+                std::swap(from, to);
             }
-            // Destructor
-            ~PrimeIterator() {}
-
-            // copy constructor
-            PrimeIterator(const PrimeIterator &other) : container(other.container), primeNumbers(other.primeNumbers), currentIndex(other.currentIndex) {}
+            if (from != sortedRuns.data())
+            {
+                std::copy(from, from + length, sortedRuns.data());
+            }
+        }
 
-            // copy assignment operator
-            PrimeIterator &operator=(const PrimeIterator &other)
+        // Append a run for every prime element of storage without tombstones. Blocks of it are compacted down to their
+        // primes in a buffer on the stack by ElementTraits::compactPrimes, so Miller-Rabin sees only the wheel's survivors
+        void appendPrimeRuns(RunVector &sortedRuns) const
+        {
+            constexpr size_t BlockSize = 1024;
+            std::array<T, BlockSize> primes;
+            for (size_t start = 0; start < elements.size(); start += BlockSize)
             {
-                if (this != &other)
+                size_t found = Traits::compactPrimes(elements.data() + start, std::min(BlockSize, elements.size() - start), primes.data());
+                for (size_t index = 0; index < found; ++index)
                 {
-                    primeNumbers = other.primeNumbers;
-                    currentIndex = other.currentIndex;
+                    sortedRuns.push_back(Run{primes[index], 1});
                 }
-                return *this;
             }
-            PrimeIterator(PrimeIterator &&other) noexcept : container(other.container), primeNumbers(std::move(other.primeNumbers)), currentIndex(other.currentIndex)
+        }
+
+        // Fill sortedRuns with the live elements accepted by keep, grouped by value in ascending order
+        template <typename Predicate>
+        void gatherSortedRuns(RunVector &sortedRuns, Predicate keep) const
+        {
+            sortedRuns.clear();
+            if (representation == Representation::RunLength)
             {
-                other.currentIndex = 0;
+                // Already sorted and grouped, so no sort is needed
+                std::copy_if(runs.begin(), runs.end(), std::back_inserter(sortedRuns), [&](const Run &run)
+                             { return keep(run.value); });
+                return;
             }
-
-            PrimeIterator &operator=(PrimeIterator &&other) noexcept
+            if constexpr (SetRepresentations)
             {
-                if (this != &other)
+                if (representation == Representation::DenseBitmap || representation == Representation::Roaring)
                 {
-                    container = other.container;
-                    primeNumbers = std::move(other.primeNumbers);
-                    currentIndex = other.currentIndex;
-                    other.currentIndex = 0;
+                    // Sets are visited in ascending order and never repeat a value, so this is one O(n) walk of the words
+                    // or chunks with no sort. The iterators still read runs, so every rebuild copies the set into one
+                    // 8-byte run per element: for a bitmap holding one element in every 32 values that is about eight times
+                    // its own size. With index compression on, packSetIndex skips the runs
+                    auto visit = [&](int element)
+                    {
+                        if (keep(element))
+                        {
+                            sortedRuns.push_back(Run{element, 1});
+                        }
+                    };
+                    if (representation == Representation::DenseBitmap)
+                    {
+                        dense.forEach(visit);
+                    }
+                    else
+                    {
+                        roaring.forEach(visit);
+                    }
+                    return;
                 }
-                return *this;
             }
 
-            bool operator==(const PrimeIterator &other) const
+            if (std::is_same_v<Predicate, PrimeElements> && deadCount == 0)
             {
-                return &container == &other.container && currentIndex == other.currentIndex;
+                appendPrimeRuns(sortedRuns);
             }
-
-            bool operator!=(const PrimeIterator &other) const
+            else
             {
-                return !(*this == other);
+                forEachLive([&](T element)
+                            {
+                                if (keep(element))
+                                {
+                                    sortedRuns.push_back(Run{element, 1});
+                                } });
+            }
+            auto byValue = [](const Run &run1, const Run &run2)
+            {
+                return run1.value < run2.value;
+            };
+            if (sortedRuns.size() <= SortingNetworkLimit)
+            {
+                networkSort(sortedRuns.data(), sortedRuns.size(), byValue);
+            }
+            else if (sortedRuns.size() < RadixSortMin)
+            {
+                std::sort(sortedRuns.begin(), sortedRuns.end(), byValue);
+            }
+            else
+            {
+                radixSort(sortedRuns);
             }
 
-            int operator*() const
+            // Merge the runs of equal values in place
+            size_t write = 0;
+            for (size_t read = 0; read < sortedRuns.size(); ++read)
             {
-                return *primeNumbers[currentIndex];
+                if (write != 0 && sortedRuns[write - 1].value == sortedRuns[read].value)
+                {
+                    addCopy(sortedRuns[write - 1]);
+                }
+                else
+                {
+                    sortedRuns[write++] = sortedRuns[read];
+                }
             }
+            sortedRuns.resize(write);
+        }
 
-            bool operator>(const PrimeIterator &other) const
+        bool indexIsCurrent(const std::shared_ptr<const SortedIndex> &index, size_t version) const
+        {
+            return index && version == mutations && !elementsExposed;
+        }
+
+        // Report an allocation made while steady-state mode is on, through the hook or else a debug assertion
+        void noteAllocation(const char *operation) const
+        {
+            if (!steadyState)
             {
-                return currentIndex > other.currentIndex;
+                return;
             }
+            if (allocationHook)
+            {
+                allocationHook(operation);
+                return;
+            }
+            assert(operation == nullptr && "MagicalContainer allocated in steady-state mode");
+        }
 
-            bool operator<(const PrimeIterator &other) const
+        // Fill in the length and, with index compression on, replace the runs by packed blocks.
+        // reservedRuns is the run capacity the index had before it was filled
+        void finishIndex(SortedIndex &index, size_t reservedRuns) const
+        {
+            index.length = expandedSize(index.runs);
+            if (!indexCompression)
             {
-                return currentIndex < other.currentIndex;
+                if (index.runs.capacity() != reservedRuns)
+                {
+                    noteAllocation("index rebuild");
+                }
+                return;
             }
-            static bool isPrime(int num)
+            if constexpr (SetRepresentations)
             {
-                if (num < 2)
+                // Packed blocks are sized exactly, so every rebuild allocates
+                noteAllocation("packed index rebuild");
+                for (const Run &run : index.runs)
                 {
-                    return false;
+                    for (size_t copy = 0; copy < run.count; ++copy)
+                    {
+                        index.packed.append(run.value);
+                    }
                 }
+                index.packed.finish();
+                index.runs = RunVector(get_allocator());
+                index.isPacked = true;
+            }
+        }
 
-                int sqrtNum = static_cast<int>(std::sqrt(num));
-                for (int i = 2; i <= sqrtNum; ++i)
+        // With index compression on, pack the elements of a set representation accepted by keep straight into index,
+        // with no runs in between. Returns false, leaving index untouched, for any other representation or with
+        // compression off
+        template <typename Predicate>
+        bool packSetIndex(SortedIndex &index, Predicate keep) const
+        {
+            if constexpr (SetRepresentations)
+            {
+                if (indexCompression && (representation == Representation::DenseBitmap || representation == Representation::Roaring))
                 {
-                    if (num % i == 0)
+                    // Packed blocks are sized exactly, so every rebuild allocates
+                    noteAllocation("packed index rebuild");
+                    auto append = [&](int element)
+                    {
+                        index.packed.append(element);
+                        ++index.length;
+                    };
+                    auto visit = [&](int element)
+                    {
+                        if (keep(element))
+                        {
+                            append(element);
+                        }
+                    };
+                    if (representation == Representation::Roaring)
+                    {
+                        roaring.forEach(visit);
+                    }
+                    else if constexpr (std::is_same_v<Predicate, PrimeElements>)
                     {
-                        return false;
+                        dense.forEachPrime(append);
                     }
+                    else
+                    {
+                        dense.forEach(visit);
+                    }
+                    index.packed.finish();
+                    index.runs = RunVector(get_allocator());
+                    index.isPacked = true;
+                    return true;
                 }
-                return true;
             }
+            return false;
+        }
 
-            PrimeIterator &operator++()
+        // Take a pooled index that no iterator holds any more, or allocate a new one and pool it while there is room
+        std::shared_ptr<SortedIndex> acquireIndex()
+        {
+            for (const auto &pooled : indexPool)
             {
-                ++currentIndex;
-                return *this;
+                if (pooled.use_count() == 1)
+                {
+                    ++poolStats.hits;
+                    pooled->clear();
+                    return pooled;
+                }
             }
-
-            PrimeIterator begin() const
+            ++poolStats.misses;
+            noteAllocation("index rebuild");
+            auto index = std::allocate_shared<SortedIndex>(get_allocator(), get_allocator());
+            if (indexPool.size() < IndexPoolSize)
             {
-                PrimeIterator iter(container);
-                iter.currentIndex = 0;
-                return iter;
+                indexPool.reserve(IndexPoolSize);
+                indexPool.push_back(index);
             }
+            return index;
+        }
 
-            PrimeIterator end() const
+        // All elements in ascending order, rebuilt only after the container changed; in lazy sorting mode a vector is
+        // heapified rather than sorted
+        std::shared_ptr<const SortedIndex> sortedIndex()
+        {
+            adaptRepresentation();
+            if (!indexIsCurrent(ascendingIndex, ascendingVersion))
             {
-                PrimeIterator iter(container);
-                iter.currentIndex = primeNumbers.size();
-                return iter;
-            }
-        };
-    };
+                ascendingIndex.reset();
+                auto index = acquireIndex();
+                size_t reservedRuns = index->runs.capacity();
+                auto everyElement = [](T)
+                {
+                    return true;
+                };
+                if (lazySorting && representation == Representation::Vector && !indexCompression)
+                {
+                    heapifyIndex(*index, reservedRuns);
+                }
+                else if (!packSetIndex(*index, everyElement))
+                {
+                    gatherSortedRuns(index->runs, everyElement);
+                    finishIndex(*index, reservedRuns);
+                }
+                ascendingIndex = std::move(index);
+                ascendingVersion = mutations;
+            }
+            return ascendingIndex;
+        }
+
+        // Fill a lazy index: the live elements as a min-max heap in O(n) and one unfilled run per element
+        void heapifyIndex(SortedIndex &index, size_t reservedRuns) const
+        {
+            size_t reservedPending = index.pending.capacity();
+            index.pending.reserve(size());
+            forEachLive([&](T element)
+                        { index.pending.push_back(element); });
+            makeMinMaxHeap(index.pending.data(), index.pending.size(), std::less<T>());
+            index.runs.assign(index.pending.size(), Run{T{}, 1});
+            index.filledBack = index.runs.size();
+            if (index.runs.capacity() != reservedRuns || index.pending.capacity() != reservedPending)
+            {
+                noteAllocation("index rebuild");
+            }
+            index.length = index.pending.size();
+            index.eagerAfter = static_cast<size_t>(lazySortFraction * static_cast<double>(index.length));
+        }
+
+        // The prime elements in ascending order; a bitmap finds them by ANDing with a prime mask
+        std::shared_ptr<const SortedIndex> primeSortedIndex()
+        {
+            adaptRepresentation();
+            if (!indexIsCurrent(primeIndex, primeVersion))
+            {
+                primeIndex.reset();
+                auto index = acquireIndex();
+                size_t reservedRuns = index->runs.capacity();
+                bool sieved = packSetIndex(*index, PrimeElements());
+                if constexpr (SetRepresentations)
+                {
+                    if (!sieved && representation == Representation::DenseBitmap)
+                    {
+                        dense.forEachPrime([&](int element)
+                                           { index->runs.push_back(Run{element, 1}); });
+                        finishIndex(*index, reservedRuns);
+                        sieved = true;
+                    }
+                }
+                if (!sieved)
+                {
+                    gatherSortedRuns(index->runs, PrimeElements());
+                    finishIndex(*index, reservedRuns);
+                }
+                primeIndex = std::move(index);
+                primeVersion = mutations;
+            }
+            return primeIndex;
+        }
+
+        // The elements accepted by a user-defined filter in ascending order, cached per filter type
+        template <typename Filter>
+        std::shared_ptr<const SortedIndex> filteredIndex()
+        {
+            adaptRepresentation();
+            auto cached = std::find_if(filterIndexes.begin(), filterIndexes.end(), [](const FilterIndex &entry)
+                                       { return entry.filter == &filterTag<Filter>; });
+            if (cached == filterIndexes.end())
+            {
+                cached = filterIndexes.insert(cached, FilterIndex{&filterTag<Filter>, nullptr, 0});
+            }
+            if (!indexIsCurrent(cached->index, cached->version))
+            {
+                cached->index.reset();
+                auto index = acquireIndex();
+                size_t reservedRuns = index->runs.capacity();
+                auto registered = findMatches<Filter>();
+                if (registered != filterMatches.end() && !elementsExposed)
+                {
+                    // Kept current by addElement and removeElement, so only the matches are copied
+                    index->runs.assign(registered->runs.begin(), registered->runs.end());
+                    finishIndex(*index, reservedRuns);
+                }
+                else if (!packSetIndex(*index, Filter()))
+                {
+                    gatherSortedRuns(index->runs, Filter());
+                    finishIndex(*index, reservedRuns);
+                }
+                cached->index = std::move(index);
+                cached->version = mutations;
+            }
+            return cached->index;
+        }
+
+        template <typename Filter>
+        auto findMatches()
+        {
+            return std::find_if(filterMatches.begin(), filterMatches.end(), [](const FilterMatches &registered)
+                                { return registered.filter == &filterTag<Filter>; });
+        }
+
+        // Count an added element in the matches of every registered filter accepting it
+        void addMatch(T element)
+        {
+            for (FilterMatches &registered : filterMatches)
+            {
+                if (!registered.accepts(element))
+                {
+                    continue;
+                }
+                auto run = std::lower_bound(registered.runs.begin(), registered.runs.end(), element, runBefore);
+                if (run != registered.runs.end() && run->value == element)
+                {
+                    addCopy(*run);
+                    continue;
+                }
+                if (registered.runs.size() == registered.runs.capacity())
+                {
+                    noteAllocation("addElement");
+                }
+                registered.runs.insert(run, Run{element, 1});
+            }
+        }
+
+        // Take a removed element out of the matches of every registered filter accepting it.
+        // The matches hold every accepted occurrence, so a value missing from them is missing from the container too
+        void removeMatch(T element, RemovalScope scope)
+        {
+            for (FilterMatches &registered : filterMatches)
+            {
+                if (!registered.accepts(element))
+                {
+                    continue;
+                }
+                auto run = std::lower_bound(registered.runs.begin(), registered.runs.end(), element, runBefore);
+                if (run == registered.runs.end() || run->value != element)
+                {
+                    continue;
+                }
+                if (scope == RemovalScope::One && run->count > 1)
+                {
+                    --run->count;
+                }
+                else
+                {
+                    registered.runs.erase(run);
+                }
+            }
+        }
+
+        // Gather the matches of every registered filter again after the elements were replaced wholesale
+        void refreshMatches()
+        {
+            for (FilterMatches &registered : filterMatches)
+            {
+                gatherSortedRuns(registered.runs, registered.accepts);
+            }
+        }
+
+        // Shared sorted index of the elements accepted by Filter
+        template <typename Filter>
+        std::shared_ptr<const SortedIndex> indexFor()
+        {
+            if constexpr (std::is_same_v<Filter, AllElements>)
+            {
+                return sortedIndex();
+            }
+            else if constexpr (std::is_same_v<Filter, PrimeElements>)
+            {
+                return primeSortedIndex();
+            }
+            else
+            {
+                return filteredIndex<Filter>();
+            }
+        }
+
+        // indexFor, expanded into one array of values for unchecked iterators
+        template <typename Filter>
+        std::shared_ptr<const SortedIndex> flatIndexFor()
+        {
+            auto index = indexFor<Filter>();
+            if (index->values.size() != index->length && index->values.capacity() < index->length)
+            {
+                noteAllocation("flat index");
+            }
+            index->flatten();
+            return index;
+        }
+
+        // Read up to limit elements of an order starting at the position of token
+        template <typename Iterator>
+        Page readPage(const PageToken &token, size_t limit)
+        {
+            Iterator iter(*this);
+            Iterator end = iter.end();
+            iter.seekPosition(token.position);
+            Page result;
+            result.elements.reserve(std::min(limit, size()));
+            size_t position = token.position;
+            for (; result.elements.size() < limit && iter != end; ++iter, ++position)
+            {
+                result.elements.push_back(*iter);
+            }
+            result.next = PageToken{mutations, position};
+            result.last = iter == end;
+            return result;
+        }
+
+        // Empty every representation and go back to an empty vector
+        void clearStorage()
+        {
+            runs.clear();
+            runTotal = 0;
+            dense = ariel::DenseBitmap<Allocator>(get_allocator());
+            roaring = ariel::RoaringSet<Allocator>(get_allocator());
+            representation = Representation::Vector;
+            elements.clear();
+            deadSlots.clear();
+            deadCount = 0;
+            heapOrdered = false;
+            extremesKnown = true; // Empty
+        }
+
+        // Free the vector storage once the elements moved to another representation
+        void releaseElements()
+        {
+            if (elementsExposed)
+            {
+                // The vector may have been changed behind the cached indexes and the matches
+                ++mutations;
+                refreshMatches();
+            }
+            elements.clear();
+            elements.shrink_to_fit();
+            deadSlots.clear();
+            deadCount = 0;
+            elementsExposed = false;
+            heapOrdered = false;
+        }
+
+        // Move the live elements of the vector into a bitmap; fails when values repeat or spread wider than maxSpan
+        bool buildDense(size_t maxSpan)
+        {
+            int low = std::numeric_limits<int>::max();
+            int high = std::numeric_limits<int>::min();
+            forEachLive([&](int element)
+                        {
+                            low = std::min(low, element);
+                            high = std::max(high, element);
+                        });
+            size_t span = size() == 0 ? 0 : static_cast<size_t>(static_cast<int64_t>(high) - low + 1);
+            if (span > maxSpan)
+            {
+                return false;
+            }
+
+            ariel::DenseBitmap<Allocator> bitmap(size() == 0 ? 0 : low, span, get_allocator());
+            bool distinct = true;
+            forEachLive([&](int element)
+                        { distinct = bitmap.insert(element) && distinct; });
+            if (!distinct)
+            {
+                return false;
+            }
+            dense = std::move(bitmap);
+            releaseElements();
+            representation = Representation::DenseBitmap;
+            return true;
+        }
+
+        // Move the live elements of the vector into a roaring set; fails when values repeat
+        bool buildRoaring()
+        {
+            ariel::RoaringSet<Allocator> set(get_allocator());
+            bool distinct = true;
+            forEachLive([&](int element)
+                        { distinct = set.insert(element) && distinct; });
+            if (!distinct)
+            {
+                return false;
+            }
+            set.runOptimize();
+            roaring = std::move(set);
+            releaseElements();
+            representation = Representation::Roaring;
+            return true;
+        }
+
+        // Widen the bitmap to cover value, at least doubling its span so that growth is amortized
+        bool growDense(int value)
+        {
+            int64_t low = dense.getBase();
+            int64_t high = low + static_cast<int64_t>(dense.getSpan());
+            int64_t exactSpan = std::max<int64_t>(high, static_cast<int64_t>(value) + 1) - std::min<int64_t>(low, value);
+            if (static_cast<size_t>(exactSpan) > DenseMaxSpan ||
+                (automaticRepresentation && static_cast<size_t>(exactSpan) > (dense.size() + 1) * DenseBitsPerElement * 2))
+            {
+                return false;
+            }
+
+            int64_t wideSpan = std::max<int64_t>(exactSpan, std::min(2 * (high - low), static_cast<int64_t>(DenseMaxSpan)));
+            if (value < low)
+            {
+                low = std::max<int64_t>(high - wideSpan, std::numeric_limits<int>::min());
+            }
+            else
+            {
+                high = std::min<int64_t>(low + wideSpan, static_cast<int64_t>(std::numeric_limits<int>::max()) + 1);
+            }
+            noteAllocation("addElement");
+            ariel::DenseBitmap<Allocator> bitmap(low, static_cast<size_t>(high - low), get_allocator());
+            dense.forEach([&](int element)
+                          { bitmap.insert(element); });
+            dense = std::move(bitmap);
+            return true;
+        }
+
+        // Expand any other representation back into the vector representation
+        void expandToVector()
+        {
+            if (representation == Representation::RunLength)
+            {
+                elements.reserve(runTotal);
+                for (const Run &run : runs)
+                {
+                    elements.insert(elements.end(), run.count, run.value);
+                }
+                runs.clear();
+                runs.shrink_to_fit();
+                runTotal = 0;
+            }
+            if constexpr (SetRepresentations)
+            {
+                if (representation == Representation::DenseBitmap)
+                {
+                    elements.reserve(dense.size());
+                    dense.forEach([&](int element)
+                                  { elements.push_back(element); });
+                    dense = ariel::DenseBitmap<Allocator>(get_allocator());
+                }
+                else if (representation == Representation::Roaring)
+                {
+                    elements.reserve(roaring.size());
+                    roaring.forEach([&](int element)
+                                    { elements.push_back(element); });
+                    roaring = ariel::RoaringSet<Allocator>(get_allocator());
+                }
+            }
+            representation = Representation::Vector;
+        }
+
+        // Go back to a vector when a set representation cannot hold the elements, and wait a while before considering a bitmap again
+        void fallBackToVector()
+        {
+            noteAllocation("representation change");
+            expandToVector();
+            nextDenseCheck = mutations + size();
+        }
+
+        // Turn a vector into a bitmap when its values are distinct and dense; checked at most once per size() mutations.
+        // A vector handed out by getElemnets stays a vector, so changes made through the reference are kept
+        void adaptRepresentation()
+        {
+            if (!SetRepresentations || !automaticRepresentation || steadyState || representation != Representation::Vector ||
+                elementsExposed || mutations < nextDenseCheck)
+            {
+                return;
+            }
+            nextDenseCheck = mutations + size();
+            if constexpr (SetRepresentations)
+            {
+                if (size() >= DenseMinSize)
+                {
+                    buildDense(std::min(DenseMaxSpan, size() * DenseBitsPerElement));
+                }
+            }
+        }
+
+        void removeFromRuns(T element, RemovalScope scope)
+        {
+            auto run = std::lower_bound(runs.begin(), runs.end(), element, runBefore);
+            if (run == runs.end() || run->value != element)
+            {
+                throw std::runtime_error("The specified element was not found in the container");
+            }
+            if (scope == RemovalScope::One && run->count > 1)
+            {
+                --run->count;
+                --runTotal;
+                return;
+            }
+            runTotal -= run->count;
+            runs.erase(run);
+        }
+
+        // Take element out of the current representation, or throw without touching it when it is not there
+        void removeStored(T element, RemovalScope scope)
+        {
+            if constexpr (SetRepresentations)
+            {
+                if (representation == Representation::DenseBitmap || representation == Representation::Roaring)
+                {
+                    bool erased = representation == Representation::DenseBitmap ? dense.erase(element) : roaring.erase(element);
+                    if (!erased)
+                    {
+                        throw std::runtime_error("The specified element was not found in the container");
+                    }
+                    return;
+                }
+            }
+            if (representation == Representation::RunLength)
+            {
+                // Runs have no slots, so the removal mode does not apply
+                removeFromRuns(element, scope);
+                return;
+            }
+            if (removalMode == RemovalMode::Tombstone)
+            {
+                size_t index = findLive(element, 0);
+                if (index == elements.size())
+                {
+                    throw std::runtime_error("The specified element was not found in the container");
+                }
+                markDead(index, element, scope);
+                return;
+            }
+
+            auto iter = std::find(elements.begin(), elements.end(), element);
+            if (iter == elements.end())
+            {
+                throw std::runtime_error("The specified element was not found in the container");
+            }
+            if (removalMode == RemovalMode::SwapAndPop)
+            {
+                swapAndPop(static_cast<size_t>(iter - elements.begin()), element, scope);
+            }
+            else if (scope == RemovalScope::One)
+            {
+                elements.erase(iter);
+            }
+            else
+            {
+                elements.erase(std::remove(iter, elements.end(), element), elements.end());
+            }
+        }
+
+        // Remove and return the smallest element, or the largest one when smallest is false. A run-length container takes
+        // it from its first or last run. Otherwise the vector is arranged into a min-max heap in O(n) on the first pop
+        // after any change but an add, and later pops and adds keep it one in O(log n); insertion order is lost,
+        // as with SwapAndPop. A set representation is expanded into a vector first
+        T popEnd(bool smallest)
+        {
+            if (size() == 0)
+            {
+                throw std::runtime_error("The container is empty");
+            }
+            ++mutations;
+            T value;
+            if (representation == Representation::RunLength)
+            {
+                value = smallest ? runs.front().value : runs.back().value;
+                removeFromRuns(value, RemovalScope::One);
+            }
+            else
+            {
+                if (representation != Representation::Vector)
+                {
+                    fallBackToVector();
+                }
+                if (!heapOrdered)
+                {
+                    compact();
+                    makeMinMaxHeap(elements.data(), elements.size(), std::less<T>());
+                    heapOrdered = true;
+                }
+                if (smallest)
+                {
+                    popMinMaxHeapMin(elements.data(), elements.size(), std::less<T>());
+                }
+                else
+                {
+                    popMinMaxHeapMax(elements.data(), elements.size(), std::less<T>());
+                }
+                value = elements.back();
+                elements.pop_back();
+            }
+            removeMatch(value, RemovalScope::One);
+            extremesKnown = false;
+            return value;
+        }
+
+        // Count, sum and extremes of the elements an aggregate has visited. The sum is kept unsigned, where overflow wraps
+        // around instead of being undefined, and is converted to Total at the end
+        struct Tally
+        {
+            uint64_t sum = 0;
+            size_t count = 0;
+            T minimum = std::numeric_limits<T>::max();
+            T maximum = std::numeric_limits<T>::lowest();
+
+            void add(T value, size_t copies)
+            {
+                sum += static_cast<uint64_t>(value) * copies;
+                count += copies;
+                minimum = std::min(minimum, value);
+                maximum = std::max(maximum, value);
+            }
+        };
+
+        // Tally values[0, count) a register's worth of lanes at a time, with a sum and extremes per lane, so the loop vectorizes
+        static void tallyBlock(const T *values, size_t count, Tally &tally)
+        {
+            constexpr size_t Lanes = Traits::SimdLanes;
+            std::array<uint64_t, Lanes> sums{};
+            std::array<T, Lanes> minima;
+            std::array<T, Lanes> maxima;
+            minima.fill(tally.minimum);
+            maxima.fill(tally.maximum);
+            size_t index = 0;
+            for (; index + Lanes <= count; index += Lanes)
+            {
+                for (size_t lane = 0; lane < Lanes; ++lane)
+                {
+                    T value = values[index + lane];
+                    sums[lane] += static_cast<uint64_t>(value);
+                    minima[lane] = std::min(minima[lane], value);
+                    maxima[lane] = std::max(maxima[lane], value);
+                }
+            }
+            for (size_t lane = 0; lane < Lanes; ++lane)
+            {
+                tally.sum += sums[lane];
+                tally.minimum = std::min(tally.minimum, minima[lane]);
+                tally.maximum = std::max(tally.maximum, maxima[lane]);
+            }
+            tally.count += index;
+            for (; index < count; ++index)
+            {
+                tally.add(values[index], 1);
+            }
+        }
+
+        // Tally the live elements Filter accepts straight from the storage, in whatever order it holds them. A bitmap is
+        // summarized a word at a time, through its prime mask for primes. Contiguous storage goes a block at a time: the
+        // accepted elements of a block are compacted on the stack with branch-free stores, by compactPrimes for primes
+        template <typename Filter>
+        Tally tallyElements() const
+        {
+            Tally tally;
+            Filter keep;
+            if (representation == Representation::RunLength)
+            {
+                for (const Run &run : runs)
+                {
+                    if (keep(run.value))
+                    {
+                        tally.add(run.value, run.count);
+                    }
+                }
+                return tally;
+            }
+            auto visit = [&](T element)
+            {
+                if (keep(element))
+                {
+                    tally.add(element, 1);
+                }
+            };
+            if constexpr (SetRepresentations)
+            {
+                if (representation == Representation::DenseBitmap)
+                {
+                    if constexpr (std::is_same_v<Filter, AllElements> || std::is_same_v<Filter, PrimeElements>)
+                    {
+                        auto summary = dense.summarize(std::is_same_v<Filter, PrimeElements>);
+                        tally.sum = static_cast<uint64_t>(summary.sum);
+                        tally.count = summary.count;
+                        tally.minimum = summary.minimum;
+                        tally.maximum = summary.maximum;
+                    }
+                    else
+                    {
+                        dense.forEach(visit);
+                    }
+                    return tally;
+                }
+                if (representation == Representation::Roaring)
+                {
+                    roaring.forEach(visit);
+                    return tally;
+                }
+            }
+            if (deadCount != 0)
+            {
+                forEachLive(visit);
+                return tally;
+            }
+
+            constexpr size_t BlockSize = 1024;
+            std::array<T, BlockSize> accepted;
+            for (size_t start = 0; start < elements.size(); start += BlockSize)
+            {
+                const T *block = elements.data() + start;
+                size_t length = std::min(BlockSize, elements.size() - start);
+                if constexpr (std::is_same_v<Filter, AllElements>)
+                {
+                    tallyBlock(block, length, tally);
+                }
+                else if constexpr (std::is_same_v<Filter, PrimeElements>)
+                {
+                    tallyBlock(accepted.data(), Traits::compactPrimes(block, length, accepted.data()), tally);
+                }
+                else
+                {
+                    size_t kept = 0;
+                    for (size_t index = 0; index < length; ++index)
+                    {
+                        accepted[kept] = block[index];
+                        kept += static_cast<size_t>(keep(block[index]));
+                    }
+                    tallyBlock(accepted.data(), kept, tally);
+                }
+            }
+            return tally;
+        }
+
+        // Find the extremes again after one of them was removed: O(1) for runs and a heap-ordered vector, one pass otherwise
+        void findExtremes() const
+        {
+            extremesKnown = true;
+            if (representation == Representation::RunLength)
+            {
+                minimum = runs.front().value;
+                maximum = runs.back().value;
+                return;
+            }
+            if (heapOrdered)
+            {
+                minimum = elements.front();
+                maximum = elements[minmaxheap::maxIndex(elements.data(), elements.size(), std::less<T>())];
+                return;
+            }
+            if (representation == Representation::Vector && deadCount == 0)
+            {
+                auto [low, high] = std::minmax_element(elements.begin(), elements.end());
+                minimum = *low;
+                maximum = *high;
+                return;
+            }
+            bool first = true;
+            auto visit = [&](T element)
+            {
+                minimum = first ? element : std::min(minimum, element);
+                maximum = first ? element : std::max(maximum, element);
+                first = false;
+            };
+            if constexpr (SetRepresentations)
+            {
+                if (representation == Representation::DenseBitmap)
+                {
+                    dense.forEach(visit);
+                    return;
+                }
+                if (representation == Representation::Roaring)
+                {
+                    roaring.forEach(visit);
+                    return;
+                }
+            }
+            forEachLive(visit);
+        }
+
+    public:
+        BasicMagicalContainer() : BasicMagicalContainer(Allocator()) {}
+
+        // Use alloc for the elements and for every index built over them
+        explicit BasicMagicalContainer(const Allocator &alloc)
+            : elements(alloc), runs(alloc), dense(alloc), roaring(alloc), indexPool(alloc), radixScratch(alloc), filterIndexes(alloc), filterMatches(alloc), deadSlots(alloc) {}
+
+        // Take over the buffer of source as the elements, without copying them
+        explicit BasicMagicalContainer(std::vector<T, Allocator> &&source) : BasicMagicalContainer(source.get_allocator())
+        {
+            adopt(std::move(source));
+        }
+
+        // Copy the elements and settings of other into storage from alloc; the copy builds its own indexes from alloc as well
+        BasicMagicalContainer(const BasicMagicalContainer &other, const Allocator &alloc) : BasicMagicalContainer(alloc)
+        {
+            // Member by member, so that nested buffers such as the filter matches and the Roaring chunks come from alloc
+            // too; a plain copy would build them with the allocator chosen by their own copy constructors
+            elements = other.elements;
+            removalMode = other.removalMode;
+            representation = other.representation;
+            runs = other.runs;
+            runTotal = other.runTotal;
+            dense = other.dense;
+            roaring = ariel::RoaringSet<Allocator>(other.roaring, alloc);
+            automaticRepresentation = other.automaticRepresentation;
+            mutations = other.mutations;
+            nextDenseCheck = other.nextDenseCheck;
+            elementsExposed = other.elementsExposed;
+            heapOrdered = other.heapOrdered;
+            minimum = other.minimum;
+            maximum = other.maximum;
+            extremesKnown = other.extremesKnown;
+            indexCompression = other.indexCompression;
+            lazySorting = other.lazySorting;
+            lazySortFraction = other.lazySortFraction;
+            filterMatches.reserve(other.filterMatches.size());
+            for (const FilterMatches &registered : other.filterMatches)
+            {
+                filterMatches.push_back(FilterMatches{registered.filter, registered.accepts, RunVector(registered.runs, alloc)});
+            }
+            steadyState = other.steadyState;
+            allocationHook = other.allocationHook;
+            deadSlots = other.deadSlots;
+            deadCount = other.deadCount;
+            compactionThreshold = other.compactionThreshold;
+        }
+
+        allocator_type get_allocator() const
+        {
+            return elements.get_allocator();
+        }
+
+        // Add an element to the container
+        void addElement(T element)
+        {
+            ++mutations;
+            addMatch(element);
+            if (extremesKnown)
+            {
+                bool empty = size() == 0;
+                minimum = empty ? element : std::min(minimum, element);
+                maximum = empty ? element : std::max(maximum, element);
+            }
+            if constexpr (SetRepresentations)
+            {
+                if (representation == Representation::DenseBitmap)
+                {
+                    if ((dense.covers(element) || growDense(element)) && dense.insert(element))
+                    {
+                        return;
+                    }
+                    // Repeated values and values far outside the range need the vector layout
+                    fallBackToVector();
+                }
+                if (representation == Representation::Roaring)
+                {
+                    if (roaring.insert(element))
+                    {
+                        return;
+                    }
+                    fallBackToVector();
+                }
+            }
+            if (representation == Representation::RunLength)
+            {
+                auto run = std::lower_bound(runs.begin(), runs.end(), element, runBefore);
+                if (run != runs.end() && run->value == element)
+                {
+                    addCopy(*run);
+                }
+                else
+                {
+                    if (runs.size() == runs.capacity())
+                    {
+                        noteAllocation("addElement");
+                    }
+                    runs.insert(run, Run{element, 1});
+                }
+                ++runTotal;
+                return;
+            }
+            if (elements.size() == elements.capacity())
+            {
+                noteAllocation("addElement");
+            }
+            elements.push_back(element);
+            if (heapOrdered)
+            {
+                pushMinMaxHeap(elements.data(), elements.size(), std::less<T>());
+            }
+        }
+
+        // Remove an element from the container
+        void removeElement(T element, RemovalScope scope = RemovalScope::All)
+        {
+            // A missing element throws before anything changes, so handed-out page tokens stay valid
+            removeStored(element, scope);
+            ++mutations;
+            removeMatch(element, scope);
+            heapOrdered = false;
+            if (element == minimum || element == maximum)
+            {
+                extremesKnown = false;
+            }
+            if constexpr (SetRepresentations)
+            {
+                if (representation == Representation::DenseBitmap && automaticRepresentation && !steadyState &&
+                    dense.getSpan() > dense.size() * DenseBitsPerElement * 2)
+                {
+                    fallBackToVector();
+                }
+            }
+        }
+
+        // Remove and return the smallest element; see popEnd for the cost
+        T popMin()
+        {
+            return popEnd(true);
+        }
+
+        // Remove and return the largest element; see popEnd for the cost
+        T popMax()
+        {
+            return popEnd(false);
+        }
+
+        // Select how removeElement closes gaps; SwapAndPop does not preserve insertion order
+        void setRemovalMode(RemovalMode mode)
+        {
+            if (mode != RemovalMode::Tombstone)
+            {
+                compact();
+            }
+            removalMode = mode;
+        }
+
+        RemovalMode getRemovalMode() const
+        {
+            return removalMode;
+        }
+
+        // Switch the internal layout; RunLength suits containers where a few values make up most of the elements,
+        // Roaring suits large, clustered sets of distinct values. DenseBitmap needs distinct values spanning at most 2^22.
+        // When the elements do not fit the target, the container is left as a vector and this throws
+        void setRepresentation(Representation target)
+        {
+            if (target == representation)
+            {
+                return;
+            }
+            if constexpr (!SetRepresentations)
+            {
+                if (target == Representation::DenseBitmap || target == Representation::Roaring)
+                {
+                    throw std::invalid_argument("Only int elements can be stored in a dense bitmap or a roaring set");
+                }
+            }
+            noteAllocation("representation change");
+            expandToVector();
+            if (target == Representation::RunLength)
+            {
+                gatherSortedRuns(runs, [](T)
+                                 { return true; });
+                runTotal = size();
+                releaseElements();
+                representation = Representation::RunLength;
+            }
+            else if constexpr (SetRepresentations)
+            {
+                if (target == Representation::DenseBitmap && !buildDense(DenseMaxSpan))
+                {
+                    throw std::invalid_argument("Only distinct elements spanning at most 2^22 values fit in a dense bitmap");
+                }
+                if (target == Representation::Roaring && !buildRoaring())
+                {
+                    throw std::invalid_argument("Only distinct elements fit in a roaring set");
+                }
+            }
+        }
+
+        Representation getRepresentation() const
+        {
+            return representation;
+        }
+
+        // Store the shared sorted indexes as delta-encoded, bit-packed blocks instead of runs (off by default).
+        // This trades a little traversal time for memory on large containers with few repeated values
+        void setIndexCompression(bool enabled)
+        {
+            if (enabled && !SetRepresentations)
+            {
+                throw std::invalid_argument("Index compression is only available for int elements");
+            }
+            if (enabled != indexCompression)
+            {
+                indexCompression = enabled;
+                ascendingIndex.reset();
+                primeIndex.reset();
+                filterIndexes.clear();
+            }
+        }
+
+        // How often iterator construction after a change could refill a pooled index instead of allocating one
+        IndexPoolStats getIndexPoolStats() const
+        {
+            return poolStats;
+        }
+
+        // Make room for count elements without regrowth, and size one pooled index per iteration order to match.
+        // The cached indexes are dropped so that their buffers can be enlarged once no iterator holds them
+        void reserve(size_t count)
+        {
+            if (representation == Representation::RunLength)
+            {
+                runs.reserve(count);
+            }
+            else if (representation == Representation::Vector)
+            {
+                elements.reserve(count);
+                deadSlots.reserve((count + SlotsPerWord - 1) / SlotsPerWord);
+            }
+            if (count >= RadixSortMin)
+            {
+                radixScratch.reserve(count);
+            }
+            for (FilterMatches &registered : filterMatches)
+            {
+                registered.runs.reserve(count);
+            }
+            ascendingIndex.reset();
+            primeIndex.reset();
+            for (FilterIndex &cached : filterIndexes)
+            {
+                cached.index.reset();
+            }
+
+            indexPool.reserve(IndexPoolSize);
+            auto idle = static_cast<size_t>(std::count_if(indexPool.begin(), indexPool.end(), [](const std::shared_ptr<SortedIndex> &pooled)
+                                                          { return pooled.use_count() == 1; }));
+            for (; idle < 2 && indexPool.size() < IndexPoolSize; ++idle)
+            {
+                indexPool.push_back(std::allocate_shared<SortedIndex>(get_allocator(), get_allocator()));
+            }
+            for (const auto &pooled : indexPool)
+            {
+                if (pooled.use_count() == 1)
+                {
+                    pooled->runs.reserve(count);
+                }
+            }
+        }
+
+        // Number of elements the container can hold before addElement has to grow its storage
+        size_t capacity() const
+        {
+            switch (representation)
+            {
+            case Representation::RunLength:
+                return runTotal + runs.capacity() - runs.size(); // Every spare run takes a new value
+            case Representation::DenseBitmap:
+                return dense.getSpan();
+            case Representation::Roaring:
+                return roaring.size();
+            case Representation::Vector:
+                break;
+            }
+            return elements.capacity() - deadCount;
+        }
+
+        // Compact the elements, free spare capacity and drop the pooled indexes no iterator holds
+        void shrink_to_fit()
+        {
+            compact();
+            elements.shrink_to_fit();
+            deadSlots.shrink_to_fit();
+            runs.shrink_to_fit();
+            radixScratch.clear();
+            radixScratch.shrink_to_fit();
+            for (FilterMatches &registered : filterMatches)
+            {
+                registered.runs.shrink_to_fit();
+            }
+            indexPool.erase(std::remove_if(indexPool.begin(), indexPool.end(), [](const std::shared_ptr<SortedIndex> &pooled)
+                                           { return pooled.use_count() == 1; }),
+                            indexPool.end());
+        }
+
+        // In steady-state mode, reached after a warm-up and reserve, every allocation made by the container is reported to
+        // hook, or trips a debug assertion when there is no hook. Automatic representation changes are suspended meanwhile.
+        // The guarantee covers the vector, run-length and dense representations with index compression off
+        void setSteadyStateMode(bool enabled, std::function<void(const char *)> hook = nullptr)
+        {
+            steadyState = enabled;
+            allocationHook = std::move(hook);
+        }
+
+        // Keep the elements accepted by Filter, a stateless predicate, up to date through every change, so that a
+        // FilterIterator<Filter> built after a change copies them in O(matches) instead of testing and sorting every element.
+        // Each registered filter adds one call of it and a binary search to addElement and removeElement; adding a new
+        // accepted value or removing the last copy of one also inserts or erases a run in the sorted matches, O(matches)
+        template <typename Filter>
+        void registerFilter()
+        {
+            if (findMatches<Filter>() != filterMatches.end())
+            {
+                return;
+            }
+            FilterMatches registered{&filterTag<Filter>, [](T element) -> bool
+                                     { return Filter()(element); },
+                                     RunVector(get_allocator())};
+            gatherSortedRuns(registered.runs, Filter());
+            filterMatches.push_back(std::move(registered));
+        }
+
+        // Stop maintaining the matches of Filter; its iterators filter every element again after a change
+        template <typename Filter>
+        void unregisterFilter()
+        {
+            auto registered = findMatches<Filter>();
+            if (registered != filterMatches.end())
+            {
+                filterMatches.erase(registered);
+            }
+        }
+
+        // Sort lazily (off by default): an iterator over all elements arranges them into a min-max heap in O(n), and each
+        // element is popped from the smallest or largest end when an iterator first reaches it, so reading the first k
+        // elements of the ascending, descending or cross order costs O(n + k log n). Once more than fraction of the
+        // elements were read that way, the rest is sorted at once. The set and run-length representations and index
+        // compression are already sorted or packed up front, so they are not affected
+        void setLazySorting(bool enabled, double fraction = 0.125)
+        {
+            if (fraction < 0 || fraction > 1)
+            {
+                throw std::invalid_argument("The lazy sort fraction must be between 0 and 1");
+            }
+            lazySorting = enabled;
+            lazySortFraction = fraction;
+        }
+
+        // Let the container switch between the vector and bitmap representations as its values change (on by default)
+        void setAutomaticRepresentation(bool enabled)
+        {
+            automaticRepresentation = enabled;
+        }
+
+        // Count the elements in [low, high]
+        size_t countInRange(T low, T high) const
+        {
+            if (low > high)
+            {
+                return 0;
+            }
+            if constexpr (SetRepresentations)
+            {
+                if (representation == Representation::DenseBitmap)
+                {
+                    return dense.countInRange(low, high);
+                }
+                if (representation == Representation::Roaring)
+                {
+                    return roaring.countInRange(low, high);
+                }
+            }
+            size_t count = 0;
+            if (representation == Representation::RunLength)
+            {
+                for (auto run = std::lower_bound(runs.begin(), runs.end(), low, runBefore); run != runs.end() && run->value <= high; ++run)
+                {
+                    count += run->count;
+                }
+                return count;
+            }
+            if (deadCount != 0)
+            {
+                forEachLive([&](T element)
+                            { count += element >= low && element <= high ? 1 : 0; });
+                return count;
+            }
+
+            // Without tombstones, count a register's worth of lanes at a time with branch-free compares so the loop vectorizes
+            constexpr size_t Lanes = Traits::SimdLanes;
+            size_t index = 0;
+            for (; index + Lanes <= elements.size(); index += Lanes)
+            {
+                size_t block = 0;
+                for (size_t lane = 0; lane < Lanes; ++lane)
+                {
+                    T element = elements[index + lane];
+                    block += static_cast<size_t>(element >= low) & static_cast<size_t>(element <= high);
+                }
+                count += block;
+            }
+            for (; index < elements.size(); ++index)
+            {
+                count += static_cast<size_t>(elements[index] >= low) & static_cast<size_t>(elements[index] <= high);
+            }
+            return count;
+        }
+
+        // Smallest element, kept up to date by addElement and found again only after removing an extreme; throws when empty
+        T min() const
+        {
+            if (size() == 0)
+            {
+                throw std::runtime_error("The container is empty");
+            }
+            if (!extremesKnown || elementsExposed)
+            {
+                findExtremes();
+            }
+            return minimum;
+        }
+
+        // Largest element, kept like min()
+        T max() const
+        {
+            if (size() == 0)
+            {
+                throw std::runtime_error("The container is empty");
+            }
+            if (!extremesKnown || elementsExposed)
+            {
+                findExtremes();
+            }
+            return maximum;
+        }
+
+        // Sum, count, smallest or largest of the elements Filter accepts, as in aggregate<PrimeElements>(Aggregate::Sum).
+        // None depends on the order, so the storage is read directly and no sorted index is built; min and max of every
+        // element come from min() and max(). Min and Max throw std::runtime_error when no element is accepted
+        template <typename Filter = AllElements>
+        Total aggregate(Aggregate operation) const
+        {
+            if constexpr (std::is_same_v<Filter, AllElements>)
+            {
+                switch (operation)
+                {
+                case Aggregate::Count:
+                    return static_cast<Total>(size());
+                case Aggregate::Min:
+                    return static_cast<Total>(min());
+                case Aggregate::Max:
+                    return static_cast<Total>(max());
+                case Aggregate::Sum:
+                    break;
+                }
+            }
+            Tally tally = tallyElements<Filter>();
+            if ((operation == Aggregate::Min || operation == Aggregate::Max) && tally.count == 0)
+            {
+                throw std::runtime_error("No element to aggregate");
+            }
+            switch (operation)
+            {
+            case Aggregate::Count:
+                return static_cast<Total>(tally.count);
+            case Aggregate::Min:
+                return static_cast<Total>(tally.minimum);
+            case Aggregate::Max:
+                return static_cast<Total>(tally.maximum);
+            case Aggregate::Sum:
+                break;
+            }
+            return static_cast<Total>(tally.sum);
+        }
+
+        // Aggregate over the elements of one of the orders page() reads; the ascending and side-cross orders hold the same elements
+        Total aggregate(PageOrder order, Aggregate operation) const
+        {
+            if (order == PageOrder::Prime)
+            {
+                return aggregate<PrimeElements>(operation);
+            }
+            return aggregate<AllElements>(operation);
+        }
+
+        // Read the page of at most limit elements of order that starts at token, and the token of the next page.
+        // A page costs O(log n + limit) while the container is unchanged, as its index stays cached between requests.
+        // A token from before a change throws std::runtime_error without rebuilding anything; begin again from PageToken()
+        Page page(PageOrder order, const PageToken &token, size_t limit)
+        {
+            if (!isCurrent(token))
+            {
+                throw std::runtime_error("The page token is from before the container changed");
+            }
+            switch (order)
+            {
+            case PageOrder::SideCross:
+                return readPage<SideCrossIterator>(token, limit);
+            case PageOrder::Prime:
+                return readPage<PrimeIterator>(token, limit);
+            case PageOrder::Ascending:
+                break;
+            }
+            return readPage<AscendingIterator>(token, limit);
+        }
+
+        // Whether page() can resume from token: it starts at the beginning or the container has not changed since
+        bool isCurrent(const PageToken &token) const
+        {
+            return token.position == 0 || token.generation == mutations;
+        }
+
+        // Check whether the container holds element
+        bool contains(T element) const
+        {
+            if (representation == Representation::RunLength)
+            {
+                auto run = std::lower_bound(runs.begin(), runs.end(), element, runBefore);
+                return run != runs.end() && run->value == element;
+            }
+            if constexpr (SetRepresentations)
+            {
+                if (representation == Representation::DenseBitmap)
+                {
+                    return dense.contains(element);
+                }
+                if (representation == Representation::Roaring)
+                {
+                    return roaring.contains(element);
+                }
+            }
+            return findLive(element, 0) != elements.size();
+        }
+
+        // Compact once more than this fraction of the slots are tombstones
+        void setCompactionThreshold(double fraction)
+        {
+            if (fraction < 0 || fraction > 1)
+            {
+                throw std::invalid_argument("The compaction threshold must be between 0 and 1");
+            }
+            compactionThreshold = fraction;
+        }
+
+        // Drop all tombstones, keeping the live elements in insertion order, and recompress a roaring set
+        void compact()
+        {
+            if (representation == Representation::Roaring)
+            {
+                roaring.runOptimize();
+            }
+            if (deadCount != 0)
+            {
+                size_t write = 0;
+                forEachLive([&](T element)
+                            { elements[write++] = element; });
+                elements.resize(write);
+            }
+            deadSlots.clear();
+            deadCount = 0;
+        }
+
+        // Get the size of the container
+        size_t size() const
+        {
+            if (representation == Representation::RunLength)
+            {
+                return runTotal;
+            }
+            if (representation == Representation::DenseBitmap)
+            {
+                return dense.size();
+            }
+            if (representation == Representation::Roaring)
+            {
+                return roaring.size();
+            }
+            return elements.size() - deadCount;
+        }
+
+        // Get the underlying vector of elements, expanding any other representation back into a vector first
+        std::vector<T, Allocator> &getElemnets()
+        {
+            setRepresentation(Representation::Vector);
+            compact();
+            elementsExposed = true;
+            heapOrdered = false;
+            extremesKnown = false;
+            return elements;
+        }
+
+        // Set the elements of the container from a given vector
+        void Setelements(std::vector<T> &container)
+        {
+            // A run-length container stays run-length; a bitmap is chosen again automatically if it still fits
+            Representation target = representation == Representation::RunLength ? Representation::RunLength : Representation::Vector;
+            clearStorage();
+            elements.assign(container.begin(), container.end());
+            ++mutations;
+            refreshMatches();
+            extremesKnown = false;
+            setRepresentation(target);
+        }
+
+        // Take over the buffer of source as the elements, in insertion order. This is O(1) unless source uses an allocator
+        // that does not compare equal to the container's, in which case the elements are moved one by one
+        void adopt(std::vector<T, Allocator> &&source)
+        {
+            clearStorage();
+            elements = std::move(source);
+            ++mutations;
+            refreshMatches();
+            extremesKnown = false;
+        }
+
+        // Hand the elements over to the caller as a vector and leave the container empty.
+        // The buffer itself is moved out, so this is O(1) for a vector without tombstones
+        std::vector<T, Allocator> release()
+        {
+            setRepresentation(Representation::Vector);
+            compact();
+            std::vector<T, Allocator> released = std::move(elements);
+            clearStorage();
+            ++mutations;
+            refreshMatches();
+            return released;
+        }
+
+        // Read-only view of the live elements in insertion order, valid until the container next changes.
+        // Any other representation is expanded into a vector first
+        std::span<const T> view()
+        {
+            if (representation != Representation::Vector)
+            {
+                fallBackToVector();
+            }
+            compact();
+            // Iterators built meanwhile must not move the elements into a bitmap behind the view
+            nextDenseCheck = std::max(nextDenseCheck, mutations + 1);
+            return std::span<const T>(elements.data(), elements.size());
+        }
+
+        // Iterator over the elements accepted by Filter in the order given by Order (see IteratorPolicies.hpp).
+        // It walks a shared sorted index from both ends, so user-defined orders and filters cost O(1) per step like the built-ins.
+        // Checking selects whether misuse throws; by default it does unless NDEBUG is defined. Unchecked iterators walk
+        // the index expanded into one array (SortedIndex::flatten) with two pointers, so ++ moves a pointer and * loads
+        // through it; the array is kept with the index until its next rebuild, on top of the runs or packed blocks
+        template <typename Order, typename Filter = AllElements, typename Checking = DefaultIteratorChecking>
+        class OrderedIterator
+        {
+        private:
+            static constexpr bool Flat = !Checking::Enabled;
+            // A flat cursor at the back points one past the next element taken from the end
+            using Cursor = std::conditional_t<Flat, const T *, IndexCursor>;
+
+            BasicMagicalContainer *container;         // The container iterated over
+            std::shared_ptr<const SortedIndex> index; // Shared index of the accepted elements in ascending order
+            Cursor front;                             // Next element taken from the start
+            Cursor back;                              // Next element taken from the end
+            size_t position = 0;                      // Current index in the order
+
+            static std::shared_ptr<const SortedIndex> indexOf(BasicMagicalContainer &cont)
+            {
+                if constexpr (Flat)
+                {
+                    return cont.template flatIndexFor<Filter>();
+                }
+                else
+                {
+                    return cont.template indexFor<Filter>();
+                }
+            }
+
+            Cursor firstCursor() const
+            {
+                if constexpr (Flat)
+                {
+                    return index->values.data();
+                }
+                else
+                {
+                    return index->first();
+                }
+            }
+
+            Cursor lastCursor() const
+            {
+                if constexpr (Flat)
+                {
+                    return index->values.data() + index->length;
+                }
+                else
+                {
+                    return index->last();
+                }
+            }
+
+            // Place flat cursors where target steps of ++ from begin() leave them
+            void placeFlat(size_t target)
+            {
+                size_t fronts = frontMoves(target + 1);
+                front = index->values.data() + fronts;
+                back = index->values.data() + index->length - (target - fronts);
+            }
+
+            void checkSameContainer(const OrderedIterator &other) const
+            {
+                if constexpr (Checking::Enabled)
+                {
+                    if (container != other.container)
+                    {
+                        throw std::runtime_error("Iterators are pointing at different containers");
+                    }
+                }
+            }
+
+            // How many of the first length - 1 positions take from the front: the rank the cursors meet at.
+            // An order may give it in closed form as a static frontMoves(length); otherwise the positions are counted
+            static size_t frontMoves(size_t length)
+            {
+                if constexpr (requires { Order::frontMoves(length); })
+                {
+                    return Order::frontMoves(length);
+                }
+                else
+                {
+                    size_t moves = 0;
+                    for (size_t step = 0; step + 1 < length; ++step)
+                    {
+                        moves += static_cast<size_t>(Order::takesFront(step));
+                    }
+                    return moves;
+                }
+            }
+
+            // Move to the next position; cursors only move while an element is left for them, so no order steps outside the index.
+            // Flat cursors have room to reach the end of the array, so they step unguarded
+            void step()
+            {
+                if constexpr (Flat)
+                {
+                    if (Order::takesFront(position))
+                    {
+                        ++front;
+                    }
+                    else
+                    {
+                        --back;
+                    }
+                }
+                else if (position + 1 < index->length)
+                {
+                    if (Order::takesFront(position))
+                    {
+                        index->next(front);
+                    }
+                    else
+                    {
+                        index->prev(back);
+                    }
+                }
+                ++position;
+            }
+
+            // Copy count > 0 elements of the index upward from cursor into out, a run or a decoded block at a time,
+            // leaving cursor on the last one
+            void readForward(IndexCursor &cursor, T *out, size_t count) const
+            {
+                if (index->isPacked)
+                {
+                    readPackedForward(cursor, out, count);
+                    return;
+                }
+                const Run *runs = index->runs.data(); // A lazy index fills its runs in place
+                size_t block = cursor.block;
+                size_t offset = cursor.offset;
+                for (size_t copied = 0;;)
+                {
+                    size_t take = std::min(runs[block].count - offset, count - copied);
+                    if (take == 1)
+                    {
+                        out[copied] = runs[block].value;
+                    }
+                    else
+                    {
+                        std::fill_n(out + copied, take, runs[block].value);
+                    }
+                    copied += take;
+                    if (copied == count)
+                    {
+                        cursor.block = block;
+                        cursor.offset = offset + take - 1;
+                        return;
+                    }
+                    ++block;
+                    offset = 0;
+                    index->reachFromFront(block);
+                }
+            }
+
+            // Copy count > 0 elements of the index downward from cursor into out, leaving cursor on the last one
+            void readBackward(IndexCursor &cursor, T *out, size_t count) const
+            {
+                if (index->isPacked)
+                {
+                    readPackedBackward(cursor, out, count);
+                    return;
+                }
+                const Run *runs = index->runs.data();
+                size_t block = cursor.block;
+                size_t offset = cursor.offset;
+                for (size_t copied = 0;;)
+                {
+                    size_t take = std::min(offset + 1, count - copied);
+                    if (take == 1)
+                    {
+                        out[copied] = runs[block].value;
+                    }
+                    else
+                    {
+                        std::fill_n(out + copied, take, runs[block].value);
+                    }
+                    copied += take;
+                    if (copied == count)
+                    {
+                        cursor.block = block;
+                        cursor.offset = offset + 1 - take;
+                        return;
+                    }
+                    --block;
+                    index->reachFromBack(block);
+                    offset = runs[block].count - 1;
+                }
+            }
+
+            // Packed counterparts of readForward and readBackward: each block is decoded whole into a buffer on the stack
+            // and copied from there, instead of extracting its deltas one at a time as ++ does
+            void readPackedForward(IndexCursor &cursor, T *out, size_t count) const
+            {
+                std::array<int, ariel::PackedSortedIndex<Allocator>::BlockSize> decoded;
+                size_t block = cursor.block;
+                size_t offset = cursor.offset;
+                for (size_t copied = 0;;)
+                {
+                    size_t take = std::min(index->packed.decode(block, decoded.data()) - offset, count - copied);
+                    std::copy_n(decoded.begin() + static_cast<ptrdiff_t>(offset), take, out + copied);
+                    copied += take;
+                    if (copied == count)
+                    {
+                        cursor = IndexCursor{block, offset + take - 1, static_cast<T>(decoded[offset + take - 1])};
+                        return;
+                    }
+                    ++block;
+                    offset = 0;
+                }
+            }
+
+            void readPackedBackward(IndexCursor &cursor, T *out, size_t count) const
+            {
+                std::array<int, ariel::PackedSortedIndex<Allocator>::BlockSize> decoded;
+                size_t block = cursor.block;
+                size_t offset = cursor.offset;
+                for (size_t copied = 0;;)
+                {
+                    index->packed.decode(block, decoded.data());
+                    size_t take = std::min(offset + 1, count - copied);
+                    std::reverse_copy(decoded.begin() + static_cast<ptrdiff_t>(offset + 1 - take), decoded.begin() + static_cast<ptrdiff_t>(offset + 1),
+                                      out + copied);
+                    copied += take;
+                    if (copied == count)
+                    {
+                        cursor = IndexCursor{block, offset + 1 - take, static_cast<T>(decoded[offset + 1 - take])};
+                        return;
+                    }
+                    --block;
+                    offset = index->packed.blockLength(block) - 1;
+                }
+            }
+
+            // Write first[0], second[0], first[1], second[1], ... to out. The plain loop is what the vectorizer turns into
+            // unpack instructions (GCC at -O3), so it needs no intrinsics and is its own scalar fallback
+            static void interleave(const T *first, const T *second, size_t pairs, T *out)
+            {
+                for (size_t pair = 0; pair < pairs; ++pair)
+                {
+                    out[2 * pair] = first[pair];
+                    out[2 * pair + 1] = second[pair];
+                }
+            }
+
+            // Copy count elements of a side-cross walk starting at an even position: blocks of the smallest
+            // remaining elements are read upward, blocks of the largest downward, and the two are interleaved
+            void copyCross(T *out, size_t count)
+            {
+                constexpr size_t BlockPairs = 256;
+                std::array<T, BlockPairs> smallest;
+                std::array<T, BlockPairs> largest;
+                for (size_t pairs = count / 2; pairs != 0;)
+                {
+                    size_t block = std::min(pairs, BlockPairs);
+                    readForward(front, smallest.data(), block);
+                    readBackward(back, largest.data(), block);
+                    interleave(smallest.data(), largest.data(), block, out);
+                    out += 2 * block;
+                    pairs -= block;
+                    position += 2 * block;
+                    // The cursors rest on the elements just read; step past them unless the walk has ended
+                    index->next(front);
+                    if (position < index->length)
+                    {
+                        index->prev(back);
+                    }
+                }
+                if (count % 2 != 0)
+                {
+                    *out = index->value(front);
+                    step();
+                }
+            }
+
+            // next_batch over the flat array: slices of it are copied, forward from front and backward from back
+            size_t copyFlat(T *out, size_t count)
+            {
+                if constexpr (std::is_same_v<Order, AscendingOrder>)
+                {
+                    std::copy(front, front + count, out);
+                    front += count;
+                }
+                else if constexpr (std::is_same_v<Order, DescendingOrder>)
+                {
+                    std::reverse_copy(back - count, back, out);
+                    back -= count;
+                }
+                else if constexpr (std::is_same_v<Order, SideCrossOrder>)
+                {
+                    size_t copied = 0;
+                    if (position % 2 != 0)
+                    {
+                        out[copied++] = *--back;
+                    }
+                    size_t pairs = (count - copied) / 2;
+                    for (size_t pair = 0; pair < pairs; ++pair)
+                    {
+                        out[copied + 2 * pair] = front[pair];
+                        out[copied + 2 * pair + 1] = back[-1 - static_cast<ptrdiff_t>(pair)];
+                    }
+                    front += pairs;
+                    back -= pairs;
+                    if ((count - copied) % 2 != 0)
+                    {
+                        out[count - 1] = *front++;
+                    }
+                }
+                else
+                {
+                    for (size_t copied = 0; copied < count; ++copied)
+                    {
+                        out[copied] = Order::takesFront(position + copied) ? *front++ : *--back;
+                    }
+                }
+                position += count;
+                return count;
+            }
+
+            void checkNotAtEnd() const
+            {
+                if constexpr (Checking::Enabled)
+                {
+                    if (position >= index->length)
+                    {
+                        throw std::runtime_error("The iterator is at the end of the container");
+                    }
+                }
+            }
+
+        public:
+            OrderedIterator(BasicMagicalContainer &cont) : container(&cont), index(indexOf(cont)), front(firstCursor()), back(lastCursor()) {}
+
+            // Copy constructor
+            OrderedIterator(const OrderedIterator &other) = default;
+
+            // Move constructor
+            OrderedIterator(OrderedIterator &&other) noexcept = default;
+
+            // Destructor
+            ~OrderedIterator() = default;
+
+            // Copy assignment operator
+            OrderedIterator &operator=(const OrderedIterator &other)
+            {
+                checkSameContainer(other);
+                container = other.container;
+                index = other.index;
+                front = other.front;
+                back = other.back;
+                position = other.position;
+                return *this;
+            }
+
+            // Move assignment operator
+            OrderedIterator &operator=(OrderedIterator &&other) noexcept(!Checking::Enabled)
+            {
+                checkSameContainer(other);
+                container = other.container;
+                index = std::move(other.index);
+                front = other.front;
+                back = other.back;
+                position = other.position;
+                return *this;
+            }
+
+            bool operator==(const OrderedIterator &other) const
+            {
+                checkSameContainer(other);
+                return container == other.container && position == other.position;
+            }
+
+            bool operator!=(const OrderedIterator &other) const
+            {
+                return !(*this == other);
+            }
+
+            bool operator>(const OrderedIterator &other) const
+            {
+                checkSameContainer(other);
+                return position > other.position;
+            }
+
+            bool operator<(const OrderedIterator &other) const
+            {
+                checkSameContainer(other);
+                return position < other.position;
+            }
+
+            T operator*() const
+            {
+                checkNotAtEnd();
+                if constexpr (Flat)
+                {
+                    return Order::takesFront(position) ? *front : back[-1];
+                }
+                else
+                {
+                    return index->value(Order::takesFront(position) ? front : back);
+                }
+            }
+
+            OrderedIterator &operator++()
+            {
+                checkNotAtEnd();
+                step();
+                return *this;
+            }
+
+            // Copy up to out.size() elements of the order into out and move past them; returns how many were copied,
+            // 0 at the end. The ascending, descending and side-cross orders are copied a run or a decoded packed block at a
+            // time, or a slice of the flat array when unchecked; other orders step the cursors without the per-element
+            // checks of ++
+            size_t next_batch(std::span<T> out)
+            {
+                size_t count = std::min(out.size(), index->length - std::min(position, index->length));
+                if (count == 0)
+                {
+                    return 0;
+                }
+                if constexpr (Flat)
+                {
+                    return copyFlat(out.data(), count);
+                }
+                else if constexpr (std::is_same_v<Order, AscendingOrder>)
+                {
+                    readForward(front, out.data(), count);
+                    position += count;
+                    if (position < index->length)
+                    {
+                        index->next(front);
+                    }
+                    return count;
+                }
+                else if constexpr (std::is_same_v<Order, DescendingOrder>)
+                {
+                    readBackward(back, out.data(), count);
+                    position += count;
+                    if (position < index->length)
+                    {
+                        index->prev(back);
+                    }
+                    return count;
+                }
+                else if constexpr (std::is_same_v<Order, SideCrossOrder>)
+                {
+                    size_t copied = 0;
+                    if (position % 2 != 0)
+                    {
+                        out[copied++] = index->value(back);
+                        step();
+                    }
+                    copyCross(out.data() + copied, count - copied);
+                    return count;
+                }
+                else
+                {
+                    for (size_t copied = 0; copied < count; ++copied)
+                    {
+                        out[copied] = index->value(Order::takesFront(position) ? front : back);
+                        step();
+                    }
+                    return count;
+                }
+            }
+
+            // Step back to the previous element of the order, undoing the cursor move of the matching ++.
+            // From end() both cursors are first placed on the last element of the order by a seek by rank
+            OrderedIterator &operator--()
+            {
+                if constexpr (Checking::Enabled)
+                {
+                    if (position == 0)
+                    {
+                        throw std::runtime_error("The iterator is at the beginning of the container");
+                    }
+                }
+                if constexpr (Flat)
+                {
+                    // end() keeps the cursors of begin()
+                    if (position == index->length)
+                    {
+                        placeFlat(position);
+                    }
+                    --position;
+                    if (Order::takesFront(position))
+                    {
+                        --front;
+                    }
+                    else
+                    {
+                        ++back;
+                    }
+                }
+                else
+                {
+                    if (position == index->length)
+                    {
+                        front = index->seek(frontMoves(index->length));
+                        back = front;
+                    }
+                    --position;
+                    if (position + 1 < index->length)
+                    {
+                        if (Order::takesFront(position))
+                        {
+                            index->prev(front);
+                        }
+                        else
+                        {
+                            index->next(back);
+                        }
+                    }
+                }
+                return *this;
+            }
+
+            // Move forward to the first element not less than value, or to end() when there is none, in O(log n):
+            // the runs are searched by galloping from the current element. Only ascending iterators can seek by value
+            OrderedIterator &seek(T value)
+            {
+                static_assert(std::is_same_v<Order, AscendingOrder>, "Seeking by value needs the ascending order; use seekPosition");
+                if (position < index->length)
+                {
+                    if constexpr (Flat)
+                    {
+                        const T *values = index->values.data();
+                        front = std::lower_bound(front, values + index->length, value);
+                        position = static_cast<size_t>(front - values);
+                    }
+                    else
+                    {
+                        position = index->lowerBound(value, front);
+                    }
+                }
+                return *this;
+            }
+
+            // Jump to a position of the order, forward or back, in O(log n): both cursors are placed by rank, which lets a
+            // SideCrossIterator resume at any position. Throws when position is past end()
+            OrderedIterator &seekPosition(size_t target)
+            {
+                if (target > index->length)
+                {
+                    throw std::invalid_argument("The position is past the end of the iterator");
+                }
+                position = target;
+                if constexpr (Flat)
+                {
+                    placeFlat(target);
+                }
+                else if (index->length != 0)
+                {
+                    // end() keeps the cursors of the last position
+                    size_t last = std::min(target, index->length - 1);
+                    size_t fronts = frontMoves(last + 1);
+                    front = index->seek(fronts);
+                    back = index->seek(index->length - 1 - (last - fronts));
+                }
+                return *this;
+            }
+
+            OrderedIterator begin() const
+            {
+                return OrderedIterator(*container);
+            }
+
+            OrderedIterator end() const
+            {
+                OrderedIterator iter(*container);
+                iter.position = iter.index->length;
+                return iter;
+            }
+
+            // Primality test behind PrimeElements: deterministic Miller-Rabin with the bases for the width of T
+            static bool isPrime(T num)
+            {
+                return Traits::isPrime(num);
+            }
+        };
+
+        using AscendingIterator = OrderedIterator<AscendingOrder>;
+        using DescendingIterator = OrderedIterator<DescendingOrder>;
+        using SideCrossIterator = OrderedIterator<SideCrossOrder>;
+        using PrimeIterator = OrderedIterator<AscendingOrder, PrimeElements>;
+
+        // Ascending iterator over the elements accepted by Filter, a stateless callable whose call is inlined into the
+        // index build; wrap a constexpr function as FunctionFilter<function>. Register the filter to keep its matches current
+        template <typename Filter>
+        using FilterIterator = OrderedIterator<AscendingOrder, Filter>;
+    };
+
+    using MagicalContainer = BasicMagicalContainer<>;
+
+    namespace pmr
+    {
+        // Containers drawing all of their memory from a std::pmr::memory_resource, such as a request-scoped arena
+        template <typename T>
+        using BasicMagicalContainer = ariel::BasicMagicalContainer<T, std::pmr::polymorphic_allocator<T>>;
+
+        using MagicalContainer = BasicMagicalContainer<int>;
+    }
 }
 #endif // MAGICALCONTAINER_HPP
@@ -0,0 +1,143 @@
+#ifndef MINMAXHEAP_HPP
+#define MINMAXHEAP_HPP
+
+#include <bit>
+#include <cstddef>
+#include <utility>
+
+namespace ariel
+{
+    // Min-max heap (Atkinson, Sack, Santoro and Strothotte, 1986): a double-ended priority queue in an array.
+    // Nodes on even levels are no larger than their descendants and nodes on odd levels no smaller, so the smallest
+    // value is at the root and the largest is one of its children. Like std::pop_heap, the pops move the value
+    // taken out to the last slot, for the caller to remove
+
+    namespace minmaxheap
+    {
+        inline bool onMinLevel(size_t index)
+        {
+            return std::bit_width(index + 1) % 2 == 1;
+        }
+
+        // Move values[index] down until the heap below it is ordered again
+        template <typename T, typename Less>
+        void trickleDown(T *values, size_t count, size_t index, Less less)
+        {
+            // On a max level the order is reversed, so one walk serves both kinds of level
+            bool minLevel = onMinLevel(index);
+            auto before = [&](const T &first, const T &second)
+            {
+                return minLevel ? less(first, second) : less(second, first);
+            };
+            while (2 * index + 1 < count)
+            {
+                // The most extreme of the children and grandchildren
+                size_t best = 2 * index + 1;
+                size_t candidates[] = {2 * index + 2, 4 * index + 3, 4 * index + 4, 4 * index + 5, 4 * index + 6};
+                for (size_t candidate : candidates)
+                {
+                    if (candidate < count && before(values[candidate], values[best]))
+                    {
+                        best = candidate;
+                    }
+                }
+                if (!before(values[best], values[index]))
+                {
+                    return;
+                }
+                std::swap(values[best], values[index]);
+                if (best <= 2 * index + 2)
+                {
+                    return; // A child has no descendants on the same kind of level below it
+                }
+                size_t parent = (best - 1) / 2;
+                if (before(values[parent], values[best]))
+                {
+                    std::swap(values[parent], values[best]);
+                }
+                index = best;
+            }
+        }
+
+        // Move values[index] up among its ancestors on levels of the same kind
+        template <typename T, typename Less>
+        void bubbleUp(T *values, size_t index, bool minLevel, Less less)
+        {
+            while (index > 2)
+            {
+                size_t grandparent = ((index - 1) / 2 - 1) / 2;
+                if (!(minLevel ? less(values[index], values[grandparent]) : less(values[grandparent], values[index])))
+                {
+                    return;
+                }
+                std::swap(values[index], values[grandparent]);
+                index = grandparent;
+            }
+        }
+
+        // Slot of the largest value of a non-empty heap
+        template <typename T, typename Less>
+        size_t maxIndex(const T *values, size_t count, Less less)
+        {
+            if (count <= 2)
+            {
+                return count - 1;
+            }
+            return less(values[1], values[2]) ? 2 : 1;
+        }
+    }
+
+    // Arrange values[0, count) into a min-max heap in O(count)
+    template <typename T, typename Less>
+    void makeMinMaxHeap(T *values, size_t count, Less less)
+    {
+        for (size_t index = count / 2; index-- > 0;)
+        {
+            minmaxheap::trickleDown(values, count, index, less);
+        }
+    }
+
+    // Add values[count - 1] to the heap values[0, count - 1) in O(log count)
+    template <typename T, typename Less>
+    void pushMinMaxHeap(T *values, size_t count, Less less)
+    {
+        size_t index = count - 1;
+        if (index == 0)
+        {
+            return;
+        }
+        size_t parent = (index - 1) / 2;
+        bool minLevel = minmaxheap::onMinLevel(index);
+        if (minLevel ? less(values[parent], values[index]) : less(values[index], values[parent]))
+        {
+            // It belongs on the levels of the other kind
+            std::swap(values[index], values[parent]);
+            minmaxheap::bubbleUp(values, parent, !minLevel, less);
+        }
+        else
+        {
+            minmaxheap::bubbleUp(values, index, minLevel, less);
+        }
+    }
+
+    // Move the smallest value of a non-empty heap to values[count - 1] in O(log count)
+    template <typename T, typename Less>
+    void popMinMaxHeapMin(T *values, size_t count, Less less)
+    {
+        std::swap(values[0], values[count - 1]);
+        minmaxheap::trickleDown(values, count - 1, 0, less);
+    }
+
+    // Move the largest value of a non-empty heap to values[count - 1] in O(log count)
+    template <typename T, typename Less>
+    void popMinMaxHeapMax(T *values, size_t count, Less less)
+    {
+        size_t largest = minmaxheap::maxIndex(values, count, less);
+        std::swap(values[largest], values[count - 1]);
+        if (largest < count - 1)
+        {
+            minmaxheap::trickleDown(values, count - 1, largest, less);
+        }
+    }
+}
+#endif // MINMAXHEAP_HPP
@@ -0,0 +1,202 @@
+#ifndef PACKEDSORTEDINDEX_HPP
+#define PACKEDSORTEDINDEX_HPP
+
+#include <vector>
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <memory>
+
+namespace ariel
+{
+    // Ascending sequence of integers stored as blocks of delta-encoded, bit-packed values.
+    // Every block header keeps its first and last value, so whole blocks can be skipped without decoding them
+    template <typename Allocator = std::allocator<uint64_t>>
+    class PackedSortedIndex
+    {
+    public:
+        static constexpr size_t BlockSize = 128;
+
+    private:
+        static constexpr size_t BitsPerWord = 64;
+
+        template <typename U>
+        using Rebind = typename std::allocator_traits<Allocator>::template rebind_alloc<U>;
+
+        struct BlockHeader
+        {
+            int first;        // Value of slot 0
+            int last;         // Value of the final slot
+            size_t bitOffset; // Position of the delta of slot 1 in bits
+            uint8_t width;    // Bits per delta
+            uint8_t length;   // Number of slots, 1 to BlockSize
+        };
+
+        std::vector<BlockHeader, Rebind<BlockHeader>> blocks;
+        std::vector<uint64_t, Rebind<uint64_t>> bits;
+        std::vector<int, Rebind<int>> pending; // Values appended since the last full block
+        size_t count = 0;
+
+        void writeBits(size_t position, uint32_t value, uint8_t width)
+        {
+            if (width == 0)
+            {
+                return;
+            }
+            size_t word = position / BitsPerWord;
+            size_t shift = position % BitsPerWord;
+            bits.resize((position + width + BitsPerWord - 1) / BitsPerWord, 0);
+            bits[word] |= uint64_t{value} << shift;
+            if (shift + width > BitsPerWord)
+            {
+                bits[word + 1] |= uint64_t{value} >> (BitsPerWord - shift);
+            }
+        }
+
+        void flushPending()
+        {
+            if (pending.empty())
+            {
+                return;
+            }
+            uint32_t widest = 0;
+            for (size_t slot = 1; slot < pending.size(); ++slot)
+            {
+                widest = std::max(widest, static_cast<uint32_t>(pending[slot]) - static_cast<uint32_t>(pending[slot - 1]));
+            }
+            auto width = static_cast<uint8_t>(std::bit_width(widest));
+            size_t offset = bits.size() * BitsPerWord;
+            for (size_t slot = 1; slot < pending.size(); ++slot)
+            {
+                writeBits(offset + (slot - 1) * width, static_cast<uint32_t>(pending[slot]) - static_cast<uint32_t>(pending[slot - 1]), width);
+            }
+            blocks.push_back(BlockHeader{pending.front(), pending.back(), offset, width, static_cast<uint8_t>(pending.size())});
+            pending.clear();
+        }
+
+    public:
+        explicit PackedSortedIndex(const Allocator &alloc = Allocator()) : blocks(alloc), bits(alloc), pending(alloc) {}
+
+        // Append the next value; values must arrive in ascending order
+        void append(int value)
+        {
+            pending.push_back(value);
+            ++count;
+            if (pending.size() == BlockSize)
+            {
+                flushPending();
+            }
+        }
+
+        // Flush the last partial block and release spare capacity once all values were appended
+        void finish()
+        {
+            flushPending();
+            pending = std::vector<int, Rebind<int>>(pending.get_allocator());
+            blocks.shrink_to_fit();
+            bits.shrink_to_fit();
+        }
+
+        // Drop all values but keep the buffers for the next round of appends
+        void clear()
+        {
+            blocks.clear();
+            bits.clear();
+            pending.clear();
+            count = 0;
+        }
+
+        // Number of values in the index
+        size_t size() const
+        {
+            return count;
+        }
+
+        size_t blockCount() const
+        {
+            return blocks.size();
+        }
+
+        size_t blockLength(size_t block) const
+        {
+            return blocks[block].length;
+        }
+
+        int firstOf(size_t block) const
+        {
+            return blocks[block].first;
+        }
+
+        int lastOf(size_t block) const
+        {
+            return blocks[block].last;
+        }
+
+        // Difference between slot and slot - 1 of block, for slot >= 1
+        uint32_t delta(size_t block, size_t slot) const
+        {
+            const BlockHeader &header = blocks[block];
+            if (header.width == 0)
+            {
+                return 0;
+            }
+            size_t position = header.bitOffset + (slot - 1) * header.width;
+            size_t word = position / BitsPerWord;
+            size_t shift = position % BitsPerWord;
+            uint64_t raw = bits[word] >> shift;
+            if (shift + header.width > BitsPerWord)
+            {
+                raw |= bits[word + 1] << (BitsPerWord - shift);
+            }
+            return static_cast<uint32_t>(raw & ((uint64_t{1} << header.width) - 1));
+        }
+
+        // Decode every value of block into out[0, blockLength(block)) and return how many there are. The deltas are
+        // unpacked in one pass over the bit stream, then summed, so a block costs no more per value than a plain copy
+        size_t decode(size_t block, int *out) const
+        {
+            const BlockHeader &header = blocks[block];
+            out[0] = header.first;
+            if (header.width == 0)
+            {
+                std::fill(out + 1, out + header.length, header.first);
+                return header.length;
+            }
+            uint64_t mask = (uint64_t{1} << header.width) - 1;
+            size_t position = header.bitOffset;
+            for (size_t slot = 1; slot < header.length; ++slot, position += header.width)
+            {
+                size_t word = position / BitsPerWord;
+                size_t shift = position % BitsPerWord;
+                uint64_t raw = bits[word] >> shift;
+                if (shift + header.width > BitsPerWord)
+                {
+                    raw |= bits[word + 1] << (BitsPerWord - shift);
+                }
+                out[slot] = static_cast<int>(static_cast<uint32_t>(raw & mask));
+            }
+            auto value = static_cast<uint32_t>(header.first);
+            for (size_t slot = 1; slot < header.length; ++slot)
+            {
+                value += static_cast<uint32_t>(out[slot]);
+                out[slot] = static_cast<int>(value);
+            }
+            return header.length;
+        }
+
+        // First block whose last value is at least value, found from the headers alone
+        size_t findBlock(int value) const
+        {
+            return static_cast<size_t>(std::lower_bound(blocks.begin(), blocks.end(), value, [](const BlockHeader &header, int target)
+                                                        { return header.last < target; }) -
+                                       blocks.begin());
+        }
+
+        size_t byteSize() const
+        {
+            return sizeof(PackedSortedIndex) + blocks.capacity() * sizeof(BlockHeader) + bits.capacity() * sizeof(uint64_t) +
+                   pending.capacity() * sizeof(int);
+        }
+    };
+}
+#endif // PACKEDSORTEDINDEX_HPP
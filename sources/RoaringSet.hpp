@@ -0,0 +1,420 @@
+#ifndef ROARINGSET_HPP
+#define ROARINGSET_HPP
+
+#include <vector>
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+
+namespace ariel
+{
+    // Compressed set of integers in the style of Roaring bitmaps: values are split by their high 16 bits
+    // into chunks, and each chunk stores its low 16 bits as a sorted array, a bitmap or a list of runs
+    template <typename Allocator = std::allocator<uint64_t>>
+    class RoaringSet
+    {
+    private:
+        template <typename U>
+        using Rebind = typename std::allocator_traits<Allocator>::template rebind_alloc<U>;
+
+        static constexpr size_t ArrayLimit = 4096;  // Largest array chunk; bigger chunks become bitmaps
+        static constexpr size_t BitmapWords = 1024; // 65536 bits
+        static constexpr size_t BitsPerWord = 64;
+        static constexpr uint32_t ChunkSize = 65536;
+
+        enum class Kind : uint8_t
+        {
+            Array,
+            Bitmap,
+            Runs
+        };
+
+        // Values start..last, inclusive
+        struct Interval
+        {
+            uint16_t start;
+            uint16_t last;
+        };
+
+        struct Chunk
+        {
+            using Values = std::vector<uint16_t, Rebind<uint16_t>>;
+            using Words = std::vector<uint64_t, Rebind<uint64_t>>;
+            using Intervals = std::vector<Interval, Rebind<Interval>>;
+
+            uint16_t key = 0;
+            Kind kind = Kind::Array;
+            uint32_t cardinality = 0;
+            Values array;        // Sorted values while kind is Array
+            Words bitmap;        // One bit per value while kind is Bitmap
+            Intervals intervals; // Sorted, disjoint runs while kind is Runs
+
+            Chunk(uint16_t chunkKey, const Allocator &alloc) : key(chunkKey), array(alloc), bitmap(alloc), intervals(alloc) {}
+
+            Chunk(const Chunk &other, const Allocator &alloc)
+                : key(other.key), kind(other.kind), cardinality(other.cardinality), array(other.array, alloc), bitmap(other.bitmap, alloc),
+                  intervals(other.intervals, alloc) {}
+
+            bool contains(uint16_t low) const
+            {
+                switch (kind)
+                {
+                case Kind::Array:
+                    return std::binary_search(array.begin(), array.end(), low);
+                case Kind::Bitmap:
+                    return ((bitmap[low / BitsPerWord] >> (low % BitsPerWord)) & 1U) != 0;
+                case Kind::Runs:
+                {
+                    auto next = std::upper_bound(intervals.begin(), intervals.end(), low, [](uint16_t value, const Interval &interval)
+                                                 { return value < interval.start; });
+                    return next != intervals.begin() && std::prev(next)->last >= low;
+                }
+                }
+                return false;
+            }
+
+            // Number of values below limit, for limit in [0, 65536]
+            uint32_t countBelow(uint32_t limit) const
+            {
+                switch (kind)
+                {
+                case Kind::Array:
+                    return static_cast<uint32_t>(std::lower_bound(array.begin(), array.end(), limit) - array.begin());
+                case Kind::Bitmap:
+                {
+                    uint32_t total = 0;
+                    for (size_t word = 0; word < limit / BitsPerWord; ++word)
+                    {
+                        total += static_cast<uint32_t>(std::popcount(bitmap[word]));
+                    }
+                    if (limit % BitsPerWord != 0)
+                    {
+                        uint64_t below = (uint64_t{1} << (limit % BitsPerWord)) - 1;
+                        total += static_cast<uint32_t>(std::popcount(bitmap[limit / BitsPerWord] & below));
+                    }
+                    return total;
+                }
+                case Kind::Runs:
+                {
+                    uint32_t total = 0;
+                    for (const Interval &interval : intervals)
+                    {
+                        if (interval.start >= limit)
+                        {
+                            break;
+                        }
+                        total += std::min<uint32_t>(interval.last + 1U, limit) - interval.start;
+                    }
+                    return total;
+                }
+                }
+                return 0;
+            }
+
+            // Call visit on every low value in ascending order
+            template <typename Visitor>
+            void forEach(Visitor visit) const
+            {
+                switch (kind)
+                {
+                case Kind::Array:
+                    for (uint16_t low : array)
+                    {
+                        visit(low);
+                    }
+                    break;
+                case Kind::Bitmap:
+                    for (size_t word = 0; word < BitmapWords; ++word)
+                    {
+                        for (uint64_t bits = bitmap[word]; bits != 0; bits &= bits - 1)
+                        {
+                            visit(static_cast<uint16_t>(word * BitsPerWord + static_cast<size_t>(std::countr_zero(bits))));
+                        }
+                    }
+                    break;
+                case Kind::Runs:
+                    for (const Interval &interval : intervals)
+                    {
+                        for (uint32_t low = interval.start; low <= interval.last; ++low)
+                        {
+                            visit(static_cast<uint16_t>(low));
+                        }
+                    }
+                    break;
+                }
+            }
+
+            void toBitmap()
+            {
+                Words bits(BitmapWords, 0, bitmap.get_allocator());
+                forEach([&](uint16_t low)
+                        { bits[low / BitsPerWord] |= uint64_t{1} << (low % BitsPerWord); });
+                bitmap = std::move(bits);
+                array = Values(array.get_allocator());
+                intervals = Intervals(intervals.get_allocator());
+                kind = Kind::Bitmap;
+            }
+
+            void toArray()
+            {
+                Values values(array.get_allocator());
+                values.reserve(cardinality);
+                forEach([&](uint16_t low)
+                        { values.push_back(low); });
+                array = std::move(values);
+                bitmap = Words(bitmap.get_allocator());
+                intervals = Intervals(intervals.get_allocator());
+                kind = Kind::Array;
+            }
+
+            // Run chunks are rebuilt as an array or bitmap before they are modified
+            void makeMutable()
+            {
+                if (kind == Kind::Runs)
+                {
+                    if (cardinality > ArrayLimit)
+                    {
+                        toBitmap();
+                    }
+                    else
+                    {
+                        toArray();
+                    }
+                }
+            }
+
+            bool insert(uint16_t low)
+            {
+                if (contains(low))
+                {
+                    return false;
+                }
+                makeMutable();
+                if (kind == Kind::Array)
+                {
+                    if (cardinality < ArrayLimit)
+                    {
+                        array.insert(std::lower_bound(array.begin(), array.end(), low), low);
+                        ++cardinality;
+                        return true;
+                    }
+                    toBitmap();
+                }
+                bitmap[low / BitsPerWord] |= uint64_t{1} << (low % BitsPerWord);
+                ++cardinality;
+                return true;
+            }
+
+            bool erase(uint16_t low)
+            {
+                if (!contains(low))
+                {
+                    return false;
+                }
+                makeMutable();
+                if (kind == Kind::Array)
+                {
+                    array.erase(std::lower_bound(array.begin(), array.end(), low));
+                }
+                else
+                {
+                    bitmap[low / BitsPerWord] &= ~(uint64_t{1} << (low % BitsPerWord));
+                    if (cardinality - 1 <= ArrayLimit)
+                    {
+                        --cardinality;
+                        toArray();
+                        return true;
+                    }
+                }
+                --cardinality;
+                return true;
+            }
+
+            // Store the chunk as runs when that is smaller than an array or a bitmap
+            void runOptimize()
+            {
+                if (kind == Kind::Runs)
+                {
+                    return;
+                }
+                Intervals runs(intervals.get_allocator());
+                forEach([&](uint16_t low)
+                        {
+                            if (!runs.empty() && runs.back().last + 1U == low)
+                            {
+                                runs.back().last = low;
+                            }
+                            else
+                            {
+                                runs.push_back(Interval{low, low});
+                            } });
+                size_t runBytes = runs.size() * sizeof(Interval);
+                size_t currentBytes = kind == Kind::Array ? cardinality * sizeof(uint16_t) : BitmapWords * sizeof(uint64_t);
+                if (runBytes < currentBytes)
+                {
+                    runs.shrink_to_fit();
+                    intervals = std::move(runs);
+                    array = Values(array.get_allocator());
+                    bitmap = Words(bitmap.get_allocator());
+                    kind = Kind::Runs;
+                }
+            }
+
+            size_t byteSize() const
+            {
+                return sizeof(Chunk) + array.capacity() * sizeof(uint16_t) + bitmap.capacity() * sizeof(uint64_t) +
+                       intervals.capacity() * sizeof(Interval);
+            }
+        };
+
+        std::vector<Chunk, Rebind<Chunk>> chunks; // Sorted by key
+        size_t count = 0;
+
+        // Flip the sign bit so that unsigned order matches signed order
+        static uint32_t toUnsigned(int value)
+        {
+            return static_cast<uint32_t>(value) ^ 0x80000000U;
+        }
+
+        static int toSigned(uint32_t value)
+        {
+            return static_cast<int>(value ^ 0x80000000U);
+        }
+
+        static uint16_t highBits(uint32_t value)
+        {
+            return static_cast<uint16_t>(value >> 16U);
+        }
+
+        static uint16_t lowBits(uint32_t value)
+        {
+            return static_cast<uint16_t>(value & 0xFFFFU);
+        }
+
+        typename std::vector<Chunk, Rebind<Chunk>>::iterator findChunk(uint16_t key)
+        {
+            return std::lower_bound(chunks.begin(), chunks.end(), key, [](const Chunk &chunk, uint16_t value)
+                                    { return chunk.key < value; });
+        }
+
+        typename std::vector<Chunk, Rebind<Chunk>>::const_iterator findChunk(uint16_t key) const
+        {
+            return std::lower_bound(chunks.begin(), chunks.end(), key, [](const Chunk &chunk, uint16_t value)
+                                    { return chunk.key < value; });
+        }
+
+    public:
+        explicit RoaringSet(const Allocator &alloc = Allocator()) : chunks(alloc) {}
+
+        // Copy other into storage from alloc, chunk buffers included
+        RoaringSet(const RoaringSet &other, const Allocator &alloc) : chunks(alloc), count(other.count)
+        {
+            chunks.reserve(other.chunks.size());
+            for (const Chunk &chunk : other.chunks)
+            {
+                chunks.emplace_back(chunk, alloc);
+            }
+        }
+
+        // Number of values in the set
+        size_t size() const
+        {
+            return count;
+        }
+
+        bool contains(int value) const
+        {
+            uint32_t bits = toUnsigned(value);
+            auto chunk = findChunk(highBits(bits));
+            return chunk != chunks.end() && chunk->key == highBits(bits) && chunk->contains(lowBits(bits));
+        }
+
+        // Add a value; returns false when it was already present
+        bool insert(int value)
+        {
+            uint32_t bits = toUnsigned(value);
+            auto chunk = findChunk(highBits(bits));
+            if (chunk == chunks.end() || chunk->key != highBits(bits))
+            {
+                chunk = chunks.insert(chunk, Chunk(highBits(bits), Allocator(chunks.get_allocator())));
+            }
+            if (!chunk->insert(lowBits(bits)))
+            {
+                return false;
+            }
+            ++count;
+            return true;
+        }
+
+        // Remove a value; returns false when it was not present
+        bool erase(int value)
+        {
+            uint32_t bits = toUnsigned(value);
+            auto chunk = findChunk(highBits(bits));
+            if (chunk == chunks.end() || chunk->key != highBits(bits) || !chunk->erase(lowBits(bits)))
+            {
+                return false;
+            }
+            if (chunk->cardinality == 0)
+            {
+                chunks.erase(chunk);
+            }
+            --count;
+            return true;
+        }
+
+        // Number of values in [low, high]
+        size_t countInRange(int low, int high) const
+        {
+            if (low > high)
+            {
+                return 0;
+            }
+            uint32_t first = toUnsigned(low);
+            uint32_t last = toUnsigned(high);
+            size_t total = 0;
+            for (auto chunk = findChunk(highBits(first)); chunk != chunks.end() && chunk->key <= highBits(last); ++chunk)
+            {
+                uint32_t from = chunk->key == highBits(first) ? lowBits(first) : 0;
+                uint32_t to = chunk->key == highBits(last) ? lowBits(last) + 1U : ChunkSize;
+                total += chunk->countBelow(to) - chunk->countBelow(from);
+            }
+            return total;
+        }
+
+        // Call visit on every value in ascending order
+        template <typename Visitor>
+        void forEach(Visitor visit) const
+        {
+            for (const Chunk &chunk : chunks)
+            {
+                uint32_t high = uint32_t{chunk.key} << 16U;
+                chunk.forEach([&](uint16_t low)
+                              { visit(toSigned(high | low)); });
+            }
+        }
+
+        // Convert chunks to run lists wherever that saves space
+        void runOptimize()
+        {
+            for (Chunk &chunk : chunks)
+            {
+                chunk.runOptimize();
+            }
+        }
+
+        // Approximate heap and object footprint in bytes
+        size_t byteSize() const
+        {
+            size_t total = sizeof(RoaringSet);
+            for (const Chunk &chunk : chunks)
+            {
+                total += chunk.byteSize();
+            }
+            return total + (chunks.capacity() - chunks.size()) * sizeof(Chunk);
+        }
+    };
+}
+#endif // ROARINGSET_HPP
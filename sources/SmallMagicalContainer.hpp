@@ -0,0 +1,104 @@
+#ifndef SMALLMAGICALCONTAINER_HPP
+#define SMALLMAGICALCONTAINER_HPP
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <memory_resource>
+
+#include "MagicalContainer.hpp"
+
+namespace ariel
+{
+    // Memory resource that hands out an inline buffer first and passes requests it cannot fit to an upstream resource.
+    // Inline space is bump-allocated and only reclaimed when the most recent block is freed, so its waste is bounded by its size
+    template <size_t Bytes>
+    class InlineBufferResource : public std::pmr::memory_resource
+    {
+    private:
+        alignas(std::max_align_t) std::byte buffer[Bytes];
+        size_t used = 0;
+        std::pmr::memory_resource *upstream;
+
+        bool owns(const void *pointer) const
+        {
+            auto *position = static_cast<const std::byte *>(pointer);
+            return std::less_equal<const std::byte *>()(buffer, position) && std::less<const std::byte *>()(position, buffer + Bytes);
+        }
+
+    protected:
+        void *do_allocate(size_t bytes, size_t alignment) override
+        {
+            void *position = buffer + used;
+            size_t space = Bytes - used;
+            if (std::align(alignment, bytes, position, space) != nullptr)
+            {
+                used = static_cast<size_t>(static_cast<std::byte *>(position) - buffer) + bytes;
+                return position;
+            }
+            return upstream->allocate(bytes, alignment);
+        }
+
+        void do_deallocate(void *pointer, size_t bytes, size_t alignment) override
+        {
+            if (!owns(pointer))
+            {
+                upstream->deallocate(pointer, bytes, alignment);
+                return;
+            }
+            auto *position = static_cast<std::byte *>(pointer);
+            if (position + bytes == buffer + used)
+            {
+                used = static_cast<size_t>(position - buffer);
+            }
+        }
+
+        bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override
+        {
+            return this == &other;
+        }
+
+    public:
+        explicit InlineBufferResource(std::pmr::memory_resource *fallback = std::pmr::get_default_resource()) : upstream(fallback) {}
+
+        InlineBufferResource(const InlineBufferResource &) = delete;
+        InlineBufferResource &operator=(const InlineBufferResource &) = delete;
+
+        // Bytes of the inline buffer in use, including space lost to alignment and to blocks freed out of order
+        size_t inlineBytesUsed() const
+        {
+            return used;
+        }
+    };
+
+    // MagicalContainer that keeps its elements and indexes in an inline buffer sized for about InlineElements elements,
+    // and spills to the default memory resource only once it grows past that. Its iterators are those of pmr::MagicalContainer
+    template <size_t InlineElements = 32>
+    class SmallMagicalContainer : private InlineBufferResource<InlineElements * 96 + 512>, public pmr::MagicalContainer
+    {
+    private:
+        // Room for the element vector as it doubles, plus both sorted indexes and their control blocks
+        using Buffer = InlineBufferResource<InlineElements * 96 + 512>;
+
+    public:
+        SmallMagicalContainer() : Buffer(), pmr::MagicalContainer(static_cast<std::pmr::memory_resource *>(this)) {}
+
+        // Copies get their own buffer, so nothing is shared with other
+        SmallMagicalContainer(const SmallMagicalContainer &other)
+            : Buffer(), pmr::MagicalContainer(other, static_cast<std::pmr::memory_resource *>(this)) {}
+
+        SmallMagicalContainer &operator=(const SmallMagicalContainer &other)
+        {
+            if (this != &other)
+            {
+                pmr::MagicalContainer::operator=(pmr::MagicalContainer(other, get_allocator()));
+            }
+            return *this;
+        }
+
+        ~SmallMagicalContainer() = default;
+
+        using Buffer::inlineBytesUsed;
+    };
+}
+#endif // SMALLMAGICALCONTAINER_HPP
@@ -0,0 +1,58 @@
+#ifndef SORTINGNETWORK_HPP
+#define SORTINGNETWORK_HPP
+
+#include <bit>
+#include <cstddef>
+
+namespace ariel
+{
+    // Largest input that is sorted with a network rather than std::sort
+    constexpr size_t SortingNetworkLimit = 32;
+
+    // Put the smaller of first and second into first; written as two selects so that it compiles without branches
+    template <typename T, typename Less>
+    void compareExchange(T &first, T &second, Less less)
+    {
+        bool swapped = less(second, first);
+        T low = swapped ? second : first;
+        T high = swapped ? first : second;
+        first = low;
+        second = high;
+    }
+
+    // Sort values[0, count) with Batcher's merge-exchange network (Knuth, Algorithm 5.2.2M).
+    // Which pairs are compared depends only on count, never on the values, so small inputs sort without mispredictions
+    template <typename T, typename Less>
+    void networkSort(T *values, size_t count, Less less)
+    {
+        if (count < 2)
+        {
+            return;
+        }
+        size_t top = std::bit_ceil(count) / 2;
+        for (size_t p = top; p > 0; p /= 2)
+        {
+            size_t q = top;
+            size_t r = 0;
+            size_t d = p;
+            while (true)
+            {
+                for (size_t i = 0; i + d < count; ++i)
+                {
+                    if ((i & p) == r)
+                    {
+                        compareExchange(values[i], values[i + d], less);
+                    }
+                }
+                if (q == p)
+                {
+                    break;
+                }
+                d = q - p;
+                q /= 2;
+                r = p;
+            }
+        }
+    }
+}
+#endif // SORTINGNETWORK_HPP